@@ -0,0 +1,13 @@
+#include "aot.h"
+
+void NES::InitAOT()
+{
+    uint8_t PRG[0x8000];
+    for(int i=0; i<0x8000; i++)
+        PRG[i] = mapper->ReadCPU(0x8000 + i);
+
+    uint32_t hash = AOTCore::HashPRG(PRG, sizeof(PRG));
+    aotProgram = aotBlocks = AOTCore::Find(hash);
+    if(aotBlocks)
+        std::cout << "Using recompiled code for PRG " << std::hex << hash << std::dec << '\n';
+}
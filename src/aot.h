@@ -0,0 +1,60 @@
+#pragma once
+#include "nes.h"
+#include <unordered_map>
+
+//runtime side of the C++ tools/nesrecomp generates from NROM games. generated code lives in src/aot/,
+//is a specialization of AOTProgram for the PRG hash and only goes through the helpers here and NES's own handlers
+struct AOTCore
+{
+    //same FNV-1a the recompiler uses, over the 32KB the CPU sees at $8000
+    static uint32_t HashPRG(const uint8_t* PRG, size_t size)
+    {
+        uint32_t hash = 2166136261u;
+        for(size_t i=0; i<size; i++)
+        {
+            hash ^= PRG[i];
+            hash *= 16777619u;
+        }
+        return hash;
+    }
+
+    static std::unordered_map<uint32_t, const AOTBlockTable*>& Registry()
+    {
+        static std::unordered_map<uint32_t, const AOTBlockTable*> registry;
+        return registry;
+    }
+
+    static const AOTBlockTable* Find(uint32_t hash)
+    {
+        auto it = Registry().find(hash);
+        return it == Registry().end() ? nullptr : it->second;
+    }
+
+    //one static instance per generated file adds its table before main runs
+    struct Registration
+    {
+        Registration(uint32_t hash, const AOTBlockTable& table) { Registry()[hash] = &table; }
+    };
+
+    //checked after every instruction, generated code returns to the core when an event is due
+    static bool Stop(NES& n)
+    {
+        return n.aotSingleStep || n.masterClock >= n.scheduler.NextDeadline();
+    }
+
+    //operand helpers matching GetOperandAddressValue, with the operand bytes baked in
+    static std::pair<uint16_t, uint16_t> Value(NES& n, uint16_t address)
+    {
+        return std::pair<uint16_t, uint16_t>(n.Read8Bit(address, false), address);
+    }
+
+    static std::pair<uint16_t, uint16_t> RAMValue(NES& n, uint16_t address)
+    {
+        return std::pair<uint16_t, uint16_t>(n.RAM[address % 0x800], address);
+    }
+
+    static std::pair<uint16_t, uint16_t> IndirectYValue(NES& n, uint16_t address)
+    {
+        return std::pair<uint16_t, uint16_t>(n.Read16Bit(address, false), address);
+    }
+};
@@ -1,9 +1,12 @@
 #include "nes.h"
+#include <cmath>
 
-
-
+template<typename Region>
 void NES::APUHandleRegisterWrite(uint16_t address, uint8_t value)
 {
+    if(address >= 0x10)
+        CatchUpDMC<Region>();
+
     constexpr uint8_t lengthLUT[32]={10, 254, 20, 2, 40, 4, 80, 6, 160, 8, 60, 10, 14, 12, 26, 14, 12, 16, 24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30};
     switch(address)
     {
@@ -103,57 +106,7 @@ void NES::APUHandleRegisterWrite(uint16_t address, uint8_t value)
     case 0xE:
         noise.loop=value & 0b10000000;
         noise.period = value & 0xF;
-        switch(noise.period)
-        {
-        case 0x0:
-            noise.periodClockCycles = header.isPAL ? 4 : 4;
-            break;
-        case 0x1:
-            noise.periodClockCycles = header.isPAL ? 8 : 8;
-            break;
-        case 0x2:
-            noise.periodClockCycles = header.isPAL ? 14 : 16;
-            break;
-        case 0x3:
-            noise.periodClockCycles = header.isPAL ? 30 : 32;
-            break;
-        case 0x4:
-            noise.periodClockCycles = header.isPAL ? 60 : 64;
-            break;
-        case 0x5:
-            noise.periodClockCycles = header.isPAL ? 88 : 96;
-            break;
-        case 0x6:
-            noise.periodClockCycles = header.isPAL ? 118 : 128;
-            break;
-        case 0x7:
-            noise.periodClockCycles = header.isPAL ? 148 : 160;
-            break;
-        case 0x8:
-            noise.periodClockCycles = header.isPAL ? 188 : 202;
-            break;
-        case 0x9:
-            noise.periodClockCycles = header.isPAL ? 236 : 254;
-            break;
-        case 0xA:
-            noise.periodClockCycles = header.isPAL ? 354 : 380;
-            break;
-        case 0xB:
-            noise.periodClockCycles = header.isPAL ? 472 : 508;
-            break;
-        case 0xC:
-            noise.periodClockCycles = header.isPAL ? 708 : 762;
-            break;
-        case 0xD:
-            noise.periodClockCycles = header.isPAL ? 944 : 1016;
-            break;
-        case 0xE:
-            noise.periodClockCycles = header.isPAL ? 1890 : 2034;
-            break;
-        case 0xF:
-            noise.periodClockCycles = header.isPAL ? 1890 : 4068;
-            break;
-        }
+        noise.periodClockCycles = Region::noisePeriods[noise.period];
     break;
     case 0xF:
         noise.length = lengthLUT[value >> 3];
@@ -164,26 +117,7 @@ void NES::APUHandleRegisterWrite(uint16_t address, uint8_t value)
         if(!DMC.IRQEnable) DMCinterrupt=false;
         DMC.loop = value & 0b1000000;
         DMC.frequency = value & 0xF;
-        DMC.frequencyDecoded=0;
-        switch(DMC.frequency)
-        {//breaks are ugly so i do like this, probably gets compiler optimized anyways
-        case 0x0: DMC.frequencyDecoded += (header.isPAL ? 44 : 48);
-        case 0x1: DMC.frequencyDecoded += (header.isPAL ? 38 : 40);
-        case 0x2: DMC.frequencyDecoded += (header.isPAL ? 18 : 20);
-        case 0x3: DMC.frequencyDecoded += (header.isPAL ? 22 : 34);
-        case 0x4: DMC.frequencyDecoded += (header.isPAL ? 40 : 32);
-        case 0x5: DMC.frequencyDecoded += (header.isPAL ? 26 : 28);
-        case 0x6: DMC.frequencyDecoded += (header.isPAL ? 12 : 12);
-        case 0x7: DMC.frequencyDecoded += (header.isPAL ? 22 : 24);
-        case 0x8: DMC.frequencyDecoded += (header.isPAL ? 28 : 30);
-        case 0x9: DMC.frequencyDecoded += (header.isPAL ? 16 : 18);
-        case 0xA: DMC.frequencyDecoded += (header.isPAL ? 14 : 14);
-        case 0xB: DMC.frequencyDecoded += (header.isPAL ? 20 : 22);
-        case 0xC: DMC.frequencyDecoded += (header.isPAL ? 20 : 22);
-        case 0xD: DMC.frequencyDecoded += (header.isPAL ? 12 : 12);
-        case 0xE: DMC.frequencyDecoded += (header.isPAL ? 16 : 18);
-        case 0xF: DMC.frequencyDecoded += (header.isPAL ? 50 : 54);
-        }
+        DMC.frequencyDecoded = Region::DMCrates[DMC.frequency];
     break;
     case 0x11:
         DMC.currentOutput = value & 0x7F;
@@ -213,12 +147,19 @@ void NES::APUHandleRegisterWrite(uint16_t address, uint8_t value)
         APUstatus.mode5steps = value & 0b10000000;
     break;
     }
+
+    if(address >= 0x10)
+        ScheduleDMCFetch<Region>();
 }
 
+template void NES::APUHandleRegisterWrite<NTSC>(uint16_t address, uint8_t value);
+template void NES::APUHandleRegisterWrite<PAL>(uint16_t address, uint8_t value);
+
 uint8_t NES::APUHandleRegisterRead(uint16_t address)
 {
     if(address!=0x15)
         return 0;
+    CatchUpDMC();
 
     uint8_t result=0;
     if(pulse1.length>0 && APUstatus.enablePulse1) result |=1;
@@ -232,15 +173,11 @@ uint8_t NES::APUHandleRegisterRead(uint16_t address)
     return result;
 }
 
+template<typename Region>
 void NES::UpdateAudio()
 {
-    UpdateDMC();
-    if (!(APUscanlineTiming >= (header.isPAL ? 156 : 131)))
-        return;
-
-    APUscanlineTiming -= header.isPAL ? 156 : 131;
-
-    FillBuffers();
+    CatchUpDMC<Region>();
+    FillBuffers<Region>();
     switch(APUstage)
     {
     case 0:
@@ -272,10 +209,49 @@ void NES::UpdateAudio()
         APUstage=0;
 }
 
-void NES::UpdateDMC()
+template void NES::UpdateAudio<NTSC>();
+template void NES::UpdateAudio<PAL>();
+
+void NES::CatchUpDMC()
+{
+    if(header.isPAL)
+        CatchUpDMC<PAL>();
+    else
+        CatchUpDMC<NTSC>();
+}
+
+template<typename Region>
+void NES::CatchUpDMC()
+{
+    //the DMC is only brought up to date when something looks at it. during overclock lines its clock is ahead and stands still
+    uint64_t elapsed = masterClock > DMClastClock ? masterClock - DMClastClock : 0;
+    int CPUcycles = Region::ToCPUcycles(elapsed);
+    DMClastClock += Region::ToPPUcycles(CPUcycles);
+    UpdateDMC<Region>(CPUcycles);
+    ScheduleDMCFetch<Region>();
+}
+
+template void NES::CatchUpDMC<NTSC>();
+template void NES::CatchUpDMC<PAL>();
+
+template<typename Region>
+void NES::ScheduleDMCFetch()
 {
-    DMCClockCycles+=(header.isPAL ? 106 : 113);
-    double samplesPerClock = 48000.0 * ((double)DMC.frequencyDecoded / (header.isPAL ? 1662607.0 : 1789773.0 ));
+    //a sample that ends with an IRQ needs to finish on time even if the game never touches the APU
+    if(!APUstatus.enableDMC || !DMC.IRQEnable || DMC.loop || DMC.silentFlag)
+    {
+        scheduler.Cancel(EVENT_DMC_FETCH);
+        return;
+    }
+    int CPUcycles = (DMC.currentBytesRemaining + 1) * DMC.frequencyDecoded - DMCClockCycles;
+    scheduler.Schedule(EVENT_DMC_FETCH, DMClastClock + Region::ToPPUcycles(CPUcycles));
+}
+
+template<typename Region>
+void NES::UpdateDMC(int CPUcycles)
+{
+    DMCClockCycles+=CPUcycles;
+    double samplesPerClock = 48000.0 * ((double)DMC.frequencyDecoded / Region::CPUclockRate);
     while (DMCClockCycles >= DMC.frequencyDecoded)
     {
         DMCClockCycles-=DMC.frequencyDecoded;
@@ -334,9 +310,10 @@ void NES::UpdateDMC()
     }
 }
 
+template<typename Region>
 void NES::FillPulseData(PulseAudio& pulseChannel, uint8_t* data, bool enabled)
 {
-    int numSamples = 12000 / (header.isPAL ? 50 : 60);
+    constexpr int numSamples = Region::samplesPerAPUStep;
     if ((pulseChannel.timer < 8 || pulseChannel.length == 0 || !enabled || pulseChannel.targetTimer > 0x7FF))
     {
         for (int i = 0; i < numSamples; i++)
@@ -347,7 +324,7 @@ void NES::FillPulseData(PulseAudio& pulseChannel, uint8_t* data, bool enabled)
     else
     {
         uint8_t volume = (pulseChannel.constantVol ? pulseChannel.volumeEnvelope : pulseChannel.decayCounter);
-        double numWaveforms = (header.isPAL ? 1662607.0 / 200.0 : 1789773.0 / 240.0) / (16.0 * (pulseChannel.timer + 1));
+        double numWaveforms = Region::CPUcyclesPerAPUStep / (16.0 * (pulseChannel.timer + 1));
         double numSamplesPerWaveform = (double)numSamples / numWaveforms;
         for(int i=0; i<numSamples; i++)
         {
@@ -359,6 +336,7 @@ void NES::FillPulseData(PulseAudio& pulseChannel, uint8_t* data, bool enabled)
     }
 }
 
+template<typename Region>
 void NES::FillBuffers()
 {
     //debug
@@ -372,12 +350,12 @@ void NES::FillBuffers()
     if(!APUstatus.enableNoise) noise.length=0;
     if(!APUstatus.enableTriangle) triangle.length=0;
 
-    int numSamples = 12000 / (header.isPAL ? 50 : 60);
+    constexpr int numSamples = Region::samplesPerAPUStep;
     //pulse channels
     uint8_t pulse1Data[numSamples];
     uint8_t pulse2Data[numSamples];
-    FillPulseData(pulse1, pulse1Data, APUstatus.enablePulse1);
-    FillPulseData(pulse2, pulse2Data, APUstatus.enablePulse2);
+    FillPulseData<Region>(pulse1, pulse1Data, APUstatus.enablePulse1);
+    FillPulseData<Region>(pulse2, pulse2Data, APUstatus.enablePulse2);
 
     //triangle
     uint8_t triangleData[numSamples];
@@ -388,7 +366,7 @@ void NES::FillBuffers()
     }
     else
     {
-        double numWaveforms = (header.isPAL ? 1662607.0 / 200.0 : 1789773.0 / 240.0) / (32 * (triangle.timer + 1));
+        double numWaveforms = Region::CPUcyclesPerAPUStep / (32 * (triangle.timer + 1));
         double numSamplesPerWaveform = (double)numSamples / numWaveforms;
         int samplesWritten =0;
         constexpr int triangleWaveformLUT[32] = {15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15};
@@ -410,10 +388,10 @@ void NES::FillBuffers()
     }
     else
     {
-        double numWaveforms = (header.isPAL ? 1662607.0 / 200.0 : 1789773.0 / 240.0) / noise.periodClockCycles;
+        double numWaveforms = Region::CPUcyclesPerAPUStep / noise.periodClockCycles;
         double numSamplesPerWaveform = (double)numSamples / numWaveforms;
         int samplesWritten = 0;
-        bool randResult = rand() & 1;
+        bool randResult = noiseRandom() & 1;
         for(int i=0; i<numSamples; i++)
         {
             if (randResult)
@@ -424,12 +402,12 @@ void NES::FillBuffers()
             while (noise.waveformPos >= numSamplesPerWaveform)
             {
                 noise.waveformPos -= numSamplesPerWaveform;
-                randResult=rand() & 1;
+                randResult=noiseRandom() & 1;
             }
         }
 
     }
-    MixAudio(pulse1Data, pulse2Data, triangleData, noiseData);
+    MixAudio<Region>(pulse1Data, pulse2Data, triangleData, noiseData);
 }
 
 void NES::ClockEnvelope(bool &envelopeStart, uint8_t &decayCounter, uint8_t &volumeEnvelope, uint8_t volumeEnvelopeLoad, bool infinite, bool constantVolume)
@@ -558,25 +536,44 @@ struct TNDLUT
     }
 };
 
+template<typename Region>
 void NES::MixAudio(uint8_t *pulse1Data, uint8_t *pulse2Data, uint8_t *triangleData, uint8_t *noiseData)
 {
     constexpr PulseLUT pulseOut;
     constexpr TNDLUT tndOut;
-    int numSamples = 12000 / (header.isPAL ? 50 : 60);
+    constexpr int numSamples = Region::samplesPerAPUStep;
     //fill out DMC with most recent value if not exactly quarter frame # samples yet
     while(DMC.inProgressData.size() < numSamples)
         DMC.inProgressData.push_back(DMC.currentOutput);
 
     for (int i = 0; i < numSamples; i++)
     {
-        partialData[partialCounter++] = (uint16_t)(20000*(pulseOut.vals[pulse1Data[i]+pulse2Data[i]] + tndOut.vals[3*triangleData[i] + 2*noiseData[i]+(DMC.inProgressData[i]*0)]));
-        
-        if(partialCounter>=512)
-        {
-            audioDataQueue.push(partialData);
-            partialCounter=0;
-        }
+        QueueSample((uint16_t)(20000*(pulseOut.vals[pulse1Data[i]+pulse2Data[i]] + tndOut.vals[3*triangleData[i] + 2*noiseData[i]+(DMC.inProgressData[i]*0)])));
     }
     DMC.inProgressData.clear();
     
+}
+
+void NES::QueueSample(uint16_t sample)
+{
+    Frontend& out = *frontend;
+    //captured as emulated, before the resampling that keeps the device's queue level
+    if(out.capture.Running())
+        out.capture.AddSample(sample);
+    //the phase counts output samples owed. at a ratio of exactly 1 every sample comes out unchanged
+    out.resamplePhase += out.resampleRatio;
+    while(out.resamplePhase >= 1.0)
+    {
+        out.resamplePhase -= 1.0;
+        //how far before the newest sample this output lies, in emulated samples
+        double back = out.resamplePhase / out.resampleRatio;
+        out.partialData[out.partialCounter++] = (uint16_t)(sample + (out.previousSample - sample) * back);
+        if(out.partialCounter>=512)
+        {
+            std::lock_guard<std::mutex> lock(out.audioMutex);
+            out.audioDataQueue.push(out.partialData);
+            out.partialCounter=0;
+        }
+    }
+    out.previousSample = sample;
 }
\ No newline at end of file
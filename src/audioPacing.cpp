@@ -0,0 +1,74 @@
+#include "audioPacing.h"
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+
+void Histogram::Add(double value)
+{
+    size_t bucket = value > 0 ? std::min(static_cast<size_t>(value / bucketWidth), buckets.size() - 1) : 0;
+    buckets[bucket]++;
+    count++;
+    sum += value;
+    sumOfSquares += value * value;
+}
+
+void Histogram::Print(std::ostream& out, const char* title, const char* unit) const
+{
+    if(count == 0)
+        return;
+    double mean = sum / count;
+    double deviation = std::sqrt(std::max(0.0, sumOfSquares / count - mean * mean));
+    out << title << ": mean " << std::fixed << std::setprecision(2) << mean << unit << ", std dev " << deviation << unit << "\n";
+    for(size_t i=0; i<buckets.size(); i++)
+    {
+        if(buckets[i] == 0)
+            continue;
+        out << "  " << std::setw(6) << std::setprecision(1) << i * bucketWidth << unit;
+        if(i + 1 < buckets.size())
+            out << " - " << std::setw(6) << (i + 1) * bucketWidth << unit;
+        else
+            out << " and up  ";
+        out << ": " << std::setw(7) << buckets[i] << " (" << std::setw(5) << 100.0 * buckets[i] / count << "%)\n";
+    }
+}
+
+void AudioPacer::SetLatency(int ms)
+{
+    latencyMs = std::max(ms, minLatencyMs);
+    targetSamples = static_cast<size_t>(sampleRate) * latencyMs / 1000;
+    queueFill = Histogram(latencyMs / 8.0);
+}
+
+uint16_t AudioPacer::DeviceSamples() const
+{
+    //a power of two no more than half the target, between 128 and the previous fixed size of 512
+    uint16_t samples = 512;
+    while(samples > 128 && samples > targetSamples / 2)
+        samples /= 2;
+    return samples;
+}
+
+std::chrono::microseconds AudioPacer::Wait(size_t queuedSamples) const
+{
+    if(queuedSamples <= targetSamples)
+        return std::chrono::microseconds(0);
+    return std::chrono::microseconds((queuedSamples - targetSamples) * 1000000 / sampleRate);
+}
+
+double AudioPacer::Update(size_t queuedSamples, double frameMs)
+{
+    frameTimes.Add(frameMs);
+    queueFill.Add(1000.0 * queuedSamples / sampleRate);
+
+    //proportional to how far the queue is from the target, the full maxRateDelta once it's empty or twice the target.
+    //Wait keeps it from growing, so in practice this refills a queue that ran low after slow frames
+    double error = (static_cast<double>(targetSamples) - static_cast<double>(queuedSamples)) / targetSamples;
+    return 1.0 + maxRateDelta * std::clamp(error, -1.0, 1.0);
+}
+
+void AudioPacer::PrintStats(std::ostream& out) const
+{
+    out << "Audio latency target: " << latencyMs << "ms, underruns: " << underruns << "\n";
+    frameTimes.Print(out, "Frame time", "ms");
+    queueFill.Print(out, "Audio queue at frame start", "ms");
+}
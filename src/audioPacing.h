@@ -0,0 +1,60 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <ostream>
+
+//counts of values in fixed width buckets starting at 0, the last bucket also takes everything above it
+class Histogram
+{
+public:
+    explicit Histogram(double bucketWidth) : bucketWidth(bucketWidth) {}
+    void Add(double value);
+    //one line per non empty bucket, followed by the mean and standard deviation
+    void Print(std::ostream& out, const char* title, const char* unit) const;
+
+private:
+    std::array<uint32_t, 40> buckets{};
+    double bucketWidth;
+    uint64_t count=0;
+    double sum=0;
+    double sumOfSquares=0;
+};
+
+//paces emulation off the audio device's clock instead of the system clock. before each frame the emulator waits
+//until the device has played the queue down to the target latency, and the samples of the next frame are resampled
+//by up to maxRateDelta so a queue that ran low refills without audible pitch changes
+class AudioPacer
+{
+public:
+    static constexpr int sampleRate = 48000;
+    static constexpr double maxRateDelta = 0.005;
+    static constexpr int minLatencyMs = 20;
+
+    AudioPacer() { SetLatency(40); }
+    //raised to minLatencyMs, below that the queue can't absorb a frame's worth of jitter
+    void SetLatency(int ms);
+    int LatencyMs() const { return latencyMs; }
+    size_t TargetSamples() const { return targetSamples; }
+    //device buffer size to ask for, small enough to leave part of the target latency to the queue
+    uint16_t DeviceSamples() const;
+
+    //how long until the queue has drained to the target
+    std::chrono::microseconds Wait(size_t queuedSamples) const;
+    //called once the wait is over with the queue level and the time since the previous frame started.
+    //returns the resampling ratio for the next frame, output samples per emulated sample
+    double Update(size_t queuedSamples, double frameMs);
+
+    //called from the audio thread when the queue ran dry
+    void CountUnderrun() { underruns++; }
+    void PrintStats(std::ostream& out) const;
+
+private:
+    int latencyMs;
+    size_t targetSamples;
+    std::atomic<uint64_t> underruns{0};
+    Histogram frameTimes{1.0};
+    Histogram queueFill{1.0};
+};
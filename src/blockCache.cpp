@@ -0,0 +1,97 @@
+#include "nes.h"
+#include "opcodes.h"
+#include <algorithm>
+
+void NES::ExecuteBlock(size_t maxInstructions)
+{
+    if(aotBlocks && registers.programCounter >= 0x8000)
+    {
+        if(auto function = (*aotBlocks)[registers.programCounter - 0x8000])
+        {
+            aotSingleStep = maxInstructions == 1;
+            return function(*this);
+        }
+    }
+
+    DecodedBlock* block = options.useBlockCache ? FindBlock() : nullptr;
+    if(!block)
+        return ExecuteInstruction();
+
+    uint32_t generation = mapper->PRGBankGeneration;
+    size_t count = std::min(maxInstructions, block->instructions.size());
+    for(size_t i=0; i<count; i++)
+    {
+        const DecodedInstruction& instruction = block->instructions[i];
+        uint16_t next = registers.programCounter + instruction.length;
+        ExecuteDecoded(instruction);
+        //leave as soon as the rest of the block may no longer be what runs next
+        if(registers.programCounter != next || mapper->PRGBankGeneration != generation || masterClock >= scheduler.NextDeadline())
+            return;
+    }
+}
+
+void NES::ExecuteDecoded(const DecodedInstruction& instruction)
+{
+    registers.programCounter++;
+    decodedOperand = instruction.operand;
+    ExecuteStep(instruction.opcode);
+    decodedOperand = nullptr;
+    masterClock += instruction.cycles;
+}
+
+//code outside PRG ROM can change under us, so it is always interpreted. so are pages patched by cheats
+DecodedBlock* NES::FindBlock()
+{
+    uint16_t address = registers.programCounter;
+    int bank = mapper->GetPRGBank(address);
+    if(bank < 0 || (cheatsActive && IsCheatedPage(address)))
+        return nullptr;
+
+    if(DecodedBlock* block = blockCache.Find(bank, address))
+    {
+        //the bank may have been decoded through another CPU window, like MMC1 mapping the same bank at $8000 and $C000,
+        //so the pages the block covers here can still be patched even though they weren't where it was decoded
+        if(cheatsActive)
+        {
+            for(int page = address >> 8; page <= (address + block->length - 1) >> 8; page++)
+            {
+                if(IsCheatedPage(page << 8))
+                    return nullptr;
+            }
+        }
+        return block;
+    }
+    return DecodeBlock(bank, address);
+}
+
+DecodedBlock* NES::DecodeBlock(int bank, uint16_t address)
+{
+    DecodedBlock block;
+    int current = address;
+    int bankEnd = address | (BlockCache::bankSize - 1);
+    while(true)
+    {
+        uint8_t opcode = mapper->ReadCPU(current);
+        uint8_t length = opcodeLengths[opcode];
+        if(current + length - 1 > bankEnd)
+            break;
+        //patched bytes are only ever read through the interpreter
+        if(cheatsActive && (IsCheatedPage(current) || IsCheatedPage(current + length - 1)))
+            break;
+
+        DecodedInstruction instruction{opcode, {0, 0}, length, (uint16_t)(opcodeCycles[opcode] * 3)};
+        for(int i=1; i<length; i++)
+            instruction.operand[i-1] = mapper->ReadCPU(current + i);
+        block.instructions.push_back(instruction);
+        block.length += length;
+
+        current += length;
+        if(IsControlFlowOpcode(opcode) || opcodeCycles[opcode] == 0 || current > bankEnd)
+            break;
+    }
+
+    //an instruction straddling two banks is left to the interpreter
+    if(block.instructions.empty())
+        return nullptr;
+    return blockCache.Insert(bank, address, std::move(block));
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <memory>
+
+//an instruction read out of ROM once, with its operand bytes and cost already resolved
+struct DecodedInstruction
+{
+    uint8_t opcode;
+    uint8_t operand[2];
+    uint8_t length;
+    uint16_t cycles; //master clock cycles
+};
+
+//straight line code up to and including the first instruction that can jump, never crossing a 16KB bank
+struct DecodedBlock
+{
+    std::vector<DecodedInstruction> instructions;
+    //bytes of ROM the instructions were read from
+    uint16_t length=0;
+};
+
+struct ROMImage;
+
+//blocks keyed by physical PRG bank and offset into it, so switching a bank out and back in keeps its blocks
+class BlockCache
+{
+public:
+    static constexpr int bankSize = 0x4000;
+
+    //copies start empty and decode their blocks again on demand. blocks only depend on the PRG data, so assigning
+    //the state of an instance of the same game, like restoring a snapshot, keeps them
+    BlockCache() = default;
+    BlockCache(const BlockCache& other) : image(other.image) {}
+    BlockCache& operator=(const BlockCache& other)
+    {
+        if(other.image != image)
+        {
+            Clear();
+            image = other.image;
+        }
+        return *this;
+    }
+
+    //the image the blocks are decoded from
+    void SetImage(const ROMImage* romImage)
+    {
+        Clear();
+        image = romImage;
+    }
+
+    DecodedBlock* Find(int bank, uint16_t address)
+    {
+        if(bank >= (int)banks.size() || !banks[bank])
+            return nullptr;
+        return banks[bank][address & (bankSize - 1)].get();
+    }
+
+    DecodedBlock* Insert(int bank, uint16_t address, DecodedBlock block)
+    {
+        if(bank >= (int)banks.size())
+            banks.resize(bank + 1);
+        if(!banks[bank])
+            banks[bank] = std::make_unique<std::unique_ptr<DecodedBlock>[]>(bankSize);
+        auto& slot = banks[bank][address & (bankSize - 1)];
+        slot = std::make_unique<DecodedBlock>(std::move(block));
+        return slot.get();
+    }
+
+    void Clear()
+    {
+        banks.clear();
+    }
+
+private:
+    const ROMImage* image=nullptr;
+    std::vector<std::unique_ptr<std::unique_ptr<DecodedBlock>[]>> banks;
+};
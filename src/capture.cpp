@@ -0,0 +1,201 @@
+#include "capture.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+
+//little endian, like the WAV header and samples
+static void Append(std::vector<char>& out, uint32_t value, int bytes)
+{
+    for(int i=0; i<bytes; i++)
+        out.push_back((char)(value >> (i * 8)));
+}
+
+static void Append(std::vector<char>& out, const std::string& text)
+{
+    out.insert(out.end(), text.begin(), text.end());
+}
+
+bool Capture::Start(const std::string& path, CaptureFormat format, int width, int height, int samplesPerFrame, const uint32_t* palette)
+{
+    this->format = format;
+    this->width = width;
+    this->height = height;
+    video.open(path + (format == CAPTURE_Y4M ? ".y4m" : ".idx"), std::ios::binary);
+    audio.open(path + ".wav", std::ios::binary);
+    if(!video.is_open() || !audio.is_open())
+    {
+        video.close();
+        audio.close();
+        return false;
+    }
+
+    //BT.601 studio range, which players assume for Y4M without a colour space tag
+    for(int i=0; i<64; i++)
+    {
+        double r = palette[i] & 0xFF, g = palette[i] >> 8 & 0xFF, b = palette[i] >> 16 & 0xFF;
+        paletteY[i] = std::lround(16 + (65.481 * r + 128.553 * g + 24.966 * b) / 255);
+        paletteU[i] = std::lround(128 + (-37.797 * r - 74.203 * g + 112.0 * b) / 255);
+        paletteV[i] = std::lround(128 + (112.0 * r - 93.786 * g - 18.214 * b) / 255);
+    }
+    int divisor = std::gcd(sampleRate, samplesPerFrame);
+    if(format == CAPTURE_Y4M)
+        Append(videoBuffer, "YUV4MPEG2 W" + std::to_string(width) + " H" + std::to_string(height) + " F" +
+                            std::to_string(sampleRate / divisor) + ":" + std::to_string(samplesPerFrame / divisor) + " Ip A1:1 C444\n");
+    //the sizes are filled in by Stop
+    Append(audioBuffer, "RIFF");
+    Append(audioBuffer, 0, 4);
+    Append(audioBuffer, "WAVEfmt ");
+    Append(audioBuffer, 16, 4);
+    Append(audioBuffer, 1, 2); //PCM
+    Append(audioBuffer, 1, 2); //mono
+    Append(audioBuffer, sampleRate, 4);
+    Append(audioBuffer, sampleRate * 2, 4);
+    Append(audioBuffer, 2, 2);
+    Append(audioBuffer, 16, 2);
+    Append(audioBuffer, "data");
+    Append(audioBuffer, 0, 4);
+
+    for(auto& slot : slots)
+        slot.indices.resize(width * height);
+    samples.reserve(samplesPerFrame * 2);
+    //what a frame dropped or skipped before anything was written repeats
+    std::vector<uint16_t> black(width * height, 0x0F);
+    EncodeFrame(black.data());
+
+    running = true;
+    thread = std::thread(&Capture::Loop, this);
+    return true;
+}
+
+void Capture::Stop()
+{
+    //frames dropped at the very end still need their repeats and samples written, which is worth waiting for here
+    if(running && pendingDrops > 0)
+    {
+        while(writeCount.load(std::memory_order_relaxed) - readCount.load(std::memory_order_acquire) == numSlots)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        pendingDrops--;
+        Queue(nullptr);
+    }
+    running = false;
+    if(thread.joinable())
+        thread.join();
+}
+
+void Capture::EndFrame(const uint16_t* indices)
+{
+    frames++;
+    uint64_t write = writeCount.load(std::memory_order_relaxed);
+    if(write - readCount.load(std::memory_order_acquire) == numSlots)
+    {
+        //the samples stay and go out with the next frame that fits
+        pendingDrops++;
+        dropped++;
+        return;
+    }
+    Queue(indices);
+}
+
+void Capture::Queue(const uint16_t* indices)
+{
+    uint64_t write = writeCount.load(std::memory_order_relaxed);
+    Slot& slot = slots[write % numSlots];
+    slot.repeat = !indices;
+    if(indices)
+        std::copy_n(indices, width * height, slot.indices.begin());
+    slot.dropped = pendingDrops;
+    pendingDrops = 0;
+    slot.samples.swap(samples);
+    samples.clear();
+    //release hands the slot's contents over with it
+    writeCount.store(write + 1, std::memory_order_release);
+}
+
+void Capture::EncodeFrame(const uint16_t* indices)
+{
+    size_t pixels = width * height;
+    if(format == CAPTURE_INDICES)
+    {
+        previousFrame.resize(pixels * sizeof(uint16_t));
+        memcpy(previousFrame.data(), indices, previousFrame.size());
+        return;
+    }
+    static const std::string frameHeader = "FRAME\n";
+    previousFrame.resize(frameHeader.size() + pixels * 3);
+    std::copy(frameHeader.begin(), frameHeader.end(), previousFrame.begin());
+    uint8_t* y = (uint8_t*)previousFrame.data() + frameHeader.size();
+    uint8_t* u = y + pixels;
+    uint8_t* v = u + pixels;
+    for(size_t i=0; i<pixels; i++)
+    {
+        int color = indices[i] & 0x3F;
+        y[i] = paletteY[color];
+        u[i] = paletteU[color];
+        v[i] = paletteV[color];
+    }
+}
+
+void Capture::Write(const Slot& slot)
+{
+    for(uint32_t i=0; i<slot.dropped; i++)
+        videoBuffer.insert(videoBuffer.end(), previousFrame.begin(), previousFrame.end());
+    if(!slot.repeat)
+        EncodeFrame(slot.indices.data());
+    videoBuffer.insert(videoBuffer.end(), previousFrame.begin(), previousFrame.end());
+
+    const char* sampleBytes = (const char*)slot.samples.data();
+    audioBuffer.insert(audioBuffer.end(), sampleBytes, sampleBytes + slot.samples.size() * sizeof(uint16_t));
+    audioBytes += slot.samples.size() * sizeof(uint16_t);
+}
+
+void Capture::Flush()
+{
+    if(!videoBuffer.empty())
+        video.write(videoBuffer.data(), videoBuffer.size());
+    if(!audioBuffer.empty())
+        audio.write(audioBuffer.data(), audioBuffer.size());
+    videoBuffer.clear();
+    audioBuffer.clear();
+}
+
+void Capture::Loop()
+{
+    while(true)
+    {
+        uint64_t read = readCount.load(std::memory_order_relaxed);
+        if(read == writeCount.load(std::memory_order_acquire))
+        {
+            //Stop is called after the last frame was queued, so once it has been the ring stays empty
+            if(!running && read == writeCount.load(std::memory_order_acquire))
+                break;
+            Flush();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+        Write(slots[read % numSlots]);
+        //release lets the emulator reuse the slot only after it was read
+        readCount.store(read + 1, std::memory_order_release);
+        //far above real time the ring rarely runs empty, this keeps the buffers from growing without bound
+        if(videoBuffer.size() + audioBuffer.size() >= flushBytes)
+            Flush();
+    }
+    Flush();
+
+    std::vector<char> size;
+    Append(size, 36 + audioBytes, 4);
+    audio.seekp(4);
+    audio.write(size.data(), 4);
+    size.clear();
+    Append(size, audioBytes, 4);
+    audio.seekp(40);
+    audio.write(size.data(), 4);
+    video.close();
+    audio.close();
+}
+
+void Capture::PrintStats(std::ostream& out) const
+{
+    out << "Captured " << frames << " frames, " << dropped << " dropped while the writer was behind and replaced by the frame before\n";
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <atomic>
+#include <thread>
+#include <ostream>
+
+enum CaptureFormat
+{
+    CAPTURE_Y4M, //YUV 4:4:4 video any player or encoder reads
+    CAPTURE_INDICES //the framebuffer as is, 16-bit little endian indices, see NES::GetFrameIndices
+};
+
+//writes every frame and the audio mixed during it to disk while the emulator runs. frames go into a fixed ring of
+//slots that a writer thread empties in large writes, so the emulator only ever copies a frame and never waits on the
+//disk. a frame that finds the ring full is dropped and the writer repeats the one before it instead, so every frame
+//still takes up one frame of video next to its audio, which is never dropped
+class Capture
+{
+public:
+    ~Capture() { Stop(); }
+    //opens path.y4m or path.idx and path.wav. the video's frame rate is the sample rate over the samples the APU mixes
+    //per frame, so the two files stay the same length. palette is the 64 colours as RGBA, like NES::RGBAPalette
+    bool Start(const std::string& path, CaptureFormat format, int width, int height, int samplesPerFrame, const uint32_t* palette);
+    //writes out everything queued and finishes the files
+    void Stop();
+    bool Running() const { return running; }
+
+    void AddSample(uint16_t sample) { samples.push_back(sample); }
+    //queues a finished frame with the samples added since the last one. null repeats the previous frame
+    void EndFrame(const uint16_t* indices);
+    void PrintStats(std::ostream& out) const;
+
+private:
+    struct Slot
+    {
+        std::vector<uint16_t> indices;
+        bool repeat=false;
+        //frames dropped right before this one, written as copies of the frame before them
+        uint32_t dropped=0;
+        std::vector<uint16_t> samples;
+    };
+
+    //into the next slot, which has to be free
+    void Queue(const uint16_t* indices);
+    void Loop();
+    void Write(const Slot& slot);
+    void EncodeFrame(const uint16_t* indices);
+    void Flush();
+
+    static constexpr size_t numSlots = 64;
+    static constexpr size_t flushBytes = 4 << 20;
+    static constexpr int sampleRate = 48000;
+
+    CaptureFormat format=CAPTURE_Y4M;
+    int width=0, height=0;
+    std::array<uint8_t, 64> paletteY{}, paletteU{}, paletteV{};
+
+    //only touched by the emulator
+    std::vector<uint16_t> samples;
+    uint32_t pendingDrops=0;
+    uint64_t frames=0;
+    uint64_t dropped=0;
+
+    //the ring, written at writeCount and read at readCount, both counting up forever
+    std::array<Slot, numSlots> slots;
+    std::atomic<uint64_t> writeCount{0};
+    std::atomic<uint64_t> readCount{0};
+
+    //only touched by the writer
+    std::ofstream video, audio;
+    std::vector<char> videoBuffer, audioBuffer;
+    //the last frame written, in the file's format
+    std::vector<char> previousFrame;
+    uint64_t audioBytes=0;
+
+    std::thread thread;
+    std::atomic<bool> running{false};
+};
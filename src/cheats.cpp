@@ -0,0 +1,118 @@
+#include "nes.h"
+#include <cctype>
+
+bool ParseCheat(const std::string& code, Cheat& cheat)
+{
+    if(code.find(':') != std::string::npos)
+    {
+        unsigned int address, value, compare;
+        int fields = sscanf(code.c_str(), "%x:%x:%x", &address, &value, &compare);
+        if(fields < 2 || address > 0xFFFF || value > 0xFF || (fields == 3 && compare > 0xFF))
+            return false;
+        cheat = Cheat{(uint16_t)address, (uint8_t)value, (int16_t)(fields == 3 ? compare : -1)};
+        return true;
+    }
+
+    if(code.length() != 6 && code.length() != 8)
+        return false;
+
+    static const std::string letters = "APZLGITYEOXUKSVN";
+    uint8_t n[8];
+    for(size_t i=0; i<code.length(); i++)
+    {
+        size_t digit = letters.find(toupper(code[i]));
+        if(digit == std::string::npos)
+            return false;
+        n[i] = digit;
+    }
+
+    //each letter is 4 bits, scrambled across the address, value and compare byte
+    cheat.address = 0x8000 | ((n[3] & 7) << 12) | ((n[5] & 7) << 8) | ((n[4] & 8) << 8) | ((n[2] & 7) << 4) | ((n[1] & 8) << 4) | (n[4] & 7) | (n[3] & 8);
+    if(code.length() == 6)
+    {
+        cheat.value = ((n[1] & 7) << 4) | ((n[0] & 8) << 4) | (n[0] & 7) | (n[5] & 8);
+        cheat.compare = -1;
+    }
+    else
+    {
+        cheat.value = ((n[1] & 7) << 4) | ((n[0] & 8) << 4) | (n[0] & 7) | (n[7] & 8);
+        cheat.compare = ((n[7] & 7) << 4) | ((n[6] & 8) << 4) | (n[6] & 7) | (n[5] & 8);
+    }
+    return true;
+}
+
+bool NES::SetCheats(const std::vector<std::string>& codes)
+{
+    std::vector<Cheat> parsed(codes.size());
+    for(size_t i=0; i<codes.size(); i++)
+    {
+        //below $8000 only RAM and cartridge RAM can be patched, registers have side effects
+        if(!ParseCheat(codes[i], parsed[i]) || (parsed[i].address >= 0x2000 && parsed[i].address < 0x6000))
+            return false;
+    }
+
+    cheats = std::move(parsed);
+    cheatShadowPages.clear();
+    std::fill(std::begin(cheatPageSlots), std::end(cheatPageSlots), 0);
+    for(const Cheat& cheat : cheats)
+    {
+        if(cheat.address < 0x8000)
+            continue;
+        uint8_t& slot = cheatPageSlots[(cheat.address - 0x8000) >> 8];
+        if(!slot)
+        {
+            cheatShadowPages.emplace_back();
+            slot = cheatShadowPages.size();
+        }
+    }
+    BuildCheatPages();
+
+    cheatsActive = !cheatShadowPages.empty();
+    //recompiled code and decoded blocks hold the unpatched bytes
+    aotBlocks = cheatsActive ? nullptr : aotProgram;
+    blockCache.Clear();
+    return true;
+}
+
+//copies every patched page from whatever banks are mapped now and applies the cheats whose compare byte matches
+void NES::BuildCheatPages()
+{
+    for(int page=0; page<0x80; page++)
+    {
+        if(!cheatPageSlots[page])
+            continue;
+        auto& shadow = cheatShadowPages[cheatPageSlots[page] - 1];
+        for(int i=0; i<0x100; i++)
+            shadow[i] = mapper->ReadCPU(0x8000 + page * 0x100 + i);
+    }
+
+    for(const Cheat& cheat : cheats)
+    {
+        if(cheat.address < 0x8000)
+            continue;
+        uint8_t& byte = cheatShadowPages[cheatPageSlots[(cheat.address - 0x8000) >> 8] - 1][cheat.address & 0xFF];
+        if(cheat.compare < 0 || byte == cheat.compare)
+            byte = cheat.value;
+    }
+    cheatPagesGeneration = mapper->PRGBankGeneration;
+}
+
+uint8_t NES::ReadCheatedPRG(uint16_t address)
+{
+    if(!IsCheatedPage(address))
+        return mapper->ReadCPU(address);
+    //a bank switch can change which compare values match
+    if(cheatPagesGeneration != mapper->PRGBankGeneration)
+        BuildCheatPages();
+    return cheatShadowPages[cheatPageSlots[(address - 0x8000) >> 8] - 1][address & 0xFF];
+}
+
+//patches below $8000 target RAM, which the game can overwrite at any time, so they are written again every frame
+void NES::ApplyRAMCheats()
+{
+    for(const Cheat& cheat : cheats)
+    {
+        if(cheat.address < 0x8000 && (cheat.compare < 0 || Read8Bit(cheat.address, false) == cheat.compare))
+            Write8Bit(cheat.address, cheat.value);
+    }
+}
@@ -0,0 +1,14 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+struct Cheat
+{
+    uint16_t address;
+    uint8_t value;
+    //only patch when the byte underneath holds this, -1 to always patch
+    int16_t compare=-1;
+};
+
+//parses a 6 or 8 letter Game Genie code, or a raw AAAA:VV or AAAA:VV:CC patch in hex. returns false if it is neither
+bool ParseCheat(const std::string& code, Cheat& cheat);
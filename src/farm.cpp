@@ -0,0 +1,78 @@
+#include "farm.h"
+#include <chrono>
+#include <iomanip>
+#include <filesystem>
+
+using namespace std;
+
+NESFarm::NESFarm(int numThreads) : pool(numThreads)
+{
+}
+
+size_t NESFarm::Add(const string& romPath, NESOptions options)
+{
+    //every instance of the same game shares one copy of its ROM
+    shared_ptr<const ROMImage>& image = images[romPath];
+    if(!image)
+    {
+        image = ROMImage::Open(romPath);
+        if(!image)
+        {
+            cerr << "Unable to read file " << romPath << '\n';
+            exit(2);
+        }
+    }
+
+    options.headless = true;
+    //every instance writes its own files instead of truncating the ones the others are writing
+    if(!options.capturePath.empty())
+        options.capturePath += "-" + to_string(instances.size());
+    instances.push_back(make_unique<NES>(image, filesystem::path(romPath).stem().string(), options));
+    return instances.size() - 1;
+}
+
+void NESFarm::RunFrames(int frames)
+{
+    //a whole batch of frames per task keeps the threads out of the pool's locks
+    ForEach([&](size_t, NES& nes)
+    {
+        for(int i=0; i<frames; i++)
+            nes.RunFrame();
+    });
+}
+
+void NESFarm::ForEach(const function<void(size_t, NES&)>& task)
+{
+    pool.ParallelFor(instances.size(), [&](size_t index)
+    {
+        task(index, *instances[index]);
+    });
+}
+
+void RunFarmBenchmark(const string& romPath, int frames)
+{
+    int cores = max(1u, thread::hardware_concurrency());
+    size_t numInstances = cores * 2;
+    cout << "Farm benchmark: " << numInstances << " instances, " << frames << " frames each\n";
+
+    double baseline = 0;
+    for(int numThreads = 1; ; numThreads = min(numThreads * 2, cores))
+    {
+        NESFarm farm(numThreads);
+        for(size_t i=0; i<numInstances; i++)
+            farm.Add(romPath);
+
+        auto start = chrono::high_resolution_clock::now();
+        farm.RunFrames(frames);
+        auto end = chrono::high_resolution_clock::now();
+
+        double framesPerSecond = numInstances * frames / chrono::duration<double>(end - start).count();
+        if(numThreads == 1)
+            baseline = framesPerSecond;
+        cout << setw(3) << numThreads << " threads: " << fixed << setprecision(0) << setw(8) << framesPerSecond << " frames/s  "
+             << setprecision(2) << framesPerSecond / baseline << "x\n";
+
+        if(numThreads == cores)
+            break;
+    }
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include "nes.h"
+#include "threadPool.h"
+#include <thread>
+#include <unordered_map>
+
+//many independent headless consoles in one process, advanced together in whole frames
+class NESFarm
+{
+public:
+    explicit NESFarm(int numThreads = std::thread::hardware_concurrency());
+
+    //returns the index of the new instance. a capturePath in the options gets the index appended, PATH-0, PATH-1...
+    size_t Add(const std::string& romPath, NESOptions options = NESOptions());
+    size_t Size() const { return instances.size(); }
+
+    //runs every instance for the given number of frames, in parallel
+    void RunFrames(int frames);
+    //calls task for every instance, in parallel
+    void ForEach(const std::function<void(size_t, NES&)>& task);
+
+    NES& Instance(size_t index) { return *instances[index]; }
+    const NES& Instance(size_t index) const { return *instances[index]; }
+    const uint32_t* GetFramebuffer(size_t index) const { return instances[index]->GetFramebuffer(); }
+    const uint8_t* GetRAM(size_t index) const { return instances[index]->GetRAM(); }
+    std::vector<uint16_t> TakeAudio(size_t index) { return instances[index]->TakeAudio(); }
+    void SetControllerState(size_t index, int player, uint8_t buttons) { instances[index]->SetControllerState(player, buttons); }
+
+    int NumThreads() const { return pool.NumThreads(); }
+
+private:
+    std::vector<std::unique_ptr<NES>> instances;
+    std::unordered_map<std::string, std::shared_ptr<const ROMImage>> images;
+    WorkStealingPool pool;
+};
+
+//runs the same set of instances with 1, 2, 4... threads up to the core count and prints the throughput
+void RunFarmBenchmark(const std::string& romPath, int frames);
@@ -0,0 +1,183 @@
+#include "lockstep.h"
+#include <iomanip>
+
+using namespace std;
+
+void printOpcode(uint8_t opcode, std::ostream& out);
+
+LockstepExecutor::LockstepExecutor(const string& romPath, const string& name, NESOptions optimizedOptions)
+{
+    shared_ptr<const ROMImage> image = ROMImage::Open(romPath);
+    if(!image)
+    {
+        cerr << "Unable to read file " << romPath << '\n';
+        exit(2);
+    }
+
+    optimizedOptions.headless = true;
+    //the reference takes the plain paths but has to emulate the same console
+    NESOptions referenceOptions = NESOptions::Reference();
+    referenceOptions.overclockLines = optimizedOptions.overclockLines;
+    referenceOptions.cheats = optimizedOptions.cheats;
+    reference = make_unique<NES>(image, name, referenceOptions);
+    optimized = make_unique<NES>(image, name, optimizedOptions);
+    reference->writeLog = &referenceWrites;
+    optimized->writeLog = &optimizedWrites;
+}
+
+void LockstepExecutor::FuzzInput(int frame)
+{
+    //same pseudo random buttons for both cores so games get past their title screens
+    if(frame % 8 != 0)
+        return;
+    uint32_t bits = (uint32_t)frame * 2654435761u;
+    bits ^= bits >> 13;
+    NES::ControllerData input;
+    input.A = bits & 1;
+    input.B = bits & 2;
+    input.select = false;
+    input.start = (frame % 128) == 64;
+    input.up = bits & 0x10;
+    input.down = bits & 0x20;
+    input.left = bits & 0x40;
+    input.right = bits & 0x80;
+    reference->currentStatePlayer1 = input;
+    optimized->currentStatePlayer1 = input;
+}
+
+bool LockstepExecutor::Run(int frames)
+{
+    while(frame < frames)
+    {
+        FuzzInput(frame);
+
+        TraceEntry& entry = history[historyPos++ % history.size()];
+        entry.programCounter = reference->registers.programCounter;
+        entry.opcode = reference->Read8Bit(entry.programCounter, false);
+        entry.referenceRegisters = reference->registers;
+        entry.processorStatus = reference->GetProcessorStatus();
+
+        referenceWrites.clear();
+        optimizedWrites.clear();
+        bool referenceFrameDone = reference->StepInstruction();
+        bool optimizedFrameDone = optimized->StepInstruction();
+        instructionCount++;
+
+        //a skipped idle loop puts the optimized core ahead, the reference has to run the iterations it jumped over
+        while(!referenceFrameDone && reference->masterClock < optimized->masterClock)
+        {
+            referenceFrameDone = reference->StepInstruction();
+            instructionCount++;
+        }
+
+        if(!CompareStep())
+            return false;
+        if(referenceFrameDone != optimizedFrameDone)
+        {
+            DumpMismatch("frame boundary");
+            return false;
+        }
+        if(referenceFrameDone)
+            frame++;
+    }
+    cout << "Lockstep run finished: " << frame << " frames, " << std::dec << instructionCount << " instructions, no divergence\n";
+    return true;
+}
+
+bool LockstepExecutor::CompareStep()
+{
+    auto& a = reference->registers;
+    auto& b = optimized->registers;
+    if(a.programCounter != b.programCounter || a.stackPointer != b.stackPointer || a.accumulator != b.accumulator ||
+       a.Xregister != b.Xregister || a.Yregister != b.Yregister || reference->GetProcessorStatus() != optimized->GetProcessorStatus())
+    {
+        DumpMismatch("registers");
+        return false;
+    }
+
+    if(reference->masterClock != optimized->masterClock || reference->scanline != optimized->scanline)
+    {
+        DumpMismatch("cycle count");
+        return false;
+    }
+
+    if(referenceWrites != optimizedWrites)
+    {
+        DumpMismatch("memory writes");
+        return false;
+    }
+
+    if(reference->lastRenderedLine != optimized->lastRenderedLine)
+    {
+        DumpMismatch("rendered scanline");
+        return false;
+    }
+
+    if(reference->lastRenderedLine != -1)
+    {
+        int line = reference->lastRenderedLine - (reference->header.isPAL ? 0 : 8);
+        const uint16_t* referenceLine = reference->GetFrameIndices() + line * 256;
+        const uint16_t* optimizedLine = optimized->GetFrameIndices() + line * 256;
+        if(memcmp(referenceLine, optimizedLine, 256 * sizeof(uint16_t)) != 0)
+        {
+            DumpMismatch("scanline output");
+            for(int i=0; i<256; i++)
+            {
+                if(referenceLine[i] != optimizedLine[i])
+                {
+                    cerr << "first differing pixel at x=" << std::dec << i << ": " << std::hex << std::setfill('0')
+                         << std::setw(3) << referenceLine[i] << " vs " << std::setw(3) << optimizedLine[i] << "\n";
+                    break;
+                }
+            }
+            return false;
+        }
+
+        if(memcmp(reference->RAM, optimized->RAM, 0x800) != 0)
+        {
+            DumpMismatch("RAM contents");
+            return false;
+        }
+    }
+    return true;
+}
+
+void LockstepExecutor::DumpRegisters(const char* label, NES& nes)
+{
+    cerr << label << " PC:" << std::hex << std::setfill('0') << std::setw(4) << nes.registers.programCounter
+         << " A:" << std::setw(2) << (int)nes.registers.accumulator
+         << " X:" << std::setw(2) << (int)nes.registers.Xregister
+         << " Y:" << std::setw(2) << (int)nes.registers.Yregister
+         << " SP:" << std::setw(2) << (int)nes.registers.stackPointer
+         << " PS:" << std::setw(2) << (int)nes.GetProcessorStatus()
+         << std::dec << " scanline:" << nes.scanline << " master clock:" << nes.masterClock << "\n";
+}
+
+void LockstepExecutor::DumpMismatch(const string& reason)
+{
+    cerr << "Lockstep divergence (" << reason << ") at frame " << std::dec << frame << ", instruction " << instructionCount << "\n";
+    cerr << "last instructions, oldest first (registers before execution):\n";
+    size_t count = min(historyPos, history.size());
+    for(size_t i = historyPos - count; i < historyPos; i++)
+    {
+        const TraceEntry& entry = history[i % history.size()];
+        cerr << "  " << std::hex << std::setfill('0') << std::setw(4) << entry.programCounter << "  " << std::setw(2) << (int)entry.opcode
+             << "  A:" << std::setw(2) << (int)entry.referenceRegisters.accumulator
+             << " X:" << std::setw(2) << (int)entry.referenceRegisters.Xregister
+             << " Y:" << std::setw(2) << (int)entry.referenceRegisters.Yregister
+             << " PS:" << std::setw(2) << (int)entry.processorStatus << "  ";
+        printOpcode(entry.opcode, cerr);
+    }
+    DumpRegisters("reference", *reference);
+    DumpRegisters("optimized", *optimized);
+
+    auto dumpWrites = [](const char* label, const vector<pair<uint16_t, uint8_t>>& writes)
+    {
+        cerr << label << " writes:";
+        for(auto& write : writes)
+            cerr << " " << std::hex << std::setfill('0') << std::setw(4) << write.first << "=" << std::setw(2) << (int)write.second;
+        cerr << "\n";
+    };
+    dumpWrites("reference", referenceWrites);
+    dumpWrites("optimized", optimizedWrites);
+}
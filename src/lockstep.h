@@ -0,0 +1,38 @@
+#pragma once
+#include "nes.h"
+#include <array>
+
+//runs a reference core and an optimized core side by side on the same ROM and stops at the first instruction where they disagree
+class LockstepExecutor
+{
+public:
+    LockstepExecutor(const std::string& romPath, const std::string& name, NESOptions optimizedOptions);
+
+    //returns true if both cores agreed for the whole run
+    bool Run(int frames);
+
+private:
+    struct TraceEntry
+    {
+        uint16_t programCounter;
+        uint8_t opcode;
+        NES::NESregisters referenceRegisters;
+        uint8_t processorStatus;
+    };
+
+    bool CompareStep();
+    void DumpMismatch(const std::string& reason);
+    void DumpRegisters(const char* label, NES& nes);
+    void FuzzInput(int frame);
+
+    std::unique_ptr<NES> reference;
+    std::unique_ptr<NES> optimized;
+
+    std::vector<std::pair<uint16_t, uint8_t>> referenceWrites;
+    std::vector<std::pair<uint16_t, uint8_t>> optimizedWrites;
+
+    std::array<TraceEntry, 32> history;
+    size_t historyPos=0;
+    uint64_t instructionCount=0;
+    int frame=0;
+};
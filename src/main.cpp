@@ -1,22 +1,69 @@
 #include "nes.h"
+#include "lockstep.h"
+#include "farm.h"
 #include <filesystem>
+#include <sstream>
 
 using namespace std;
 
 int main(int argc, char* argv[])
 {
-    SDL_Init(SDL_INIT_EVERYTHING);
-    filesystem::create_directory("saves");
-    
     string romPath="";
+    int lockstepFrames=0;
+    int farmBenchFrames=0;
+    NESOptions options;
     for(int i=0; i<argc; i++)
     {
         string argument(argv[i]);
         if(argument.length()>3 && argument[0]=='-' && argument[1]=='p' && argument[2]=='=')
-        {
             romPath=argument.substr(3);
-            break;
+        else if(argument.rfind("-lockstep=", 0) == 0)
+            lockstepFrames=stoi(argument.substr(10));
+        else if(argument.rfind("-idle=", 0) == 0)
+        {
+            stringstream hints(argument.substr(6));
+            string hint;
+            while(getline(hints, hint, ','))
+                options.idleLoopHints.push_back(stoi(hint, nullptr, 16));
+        }
+        else if(argument == "-farmbench")
+            farmBenchFrames=600;
+        else if(argument.rfind("-farmbench=", 0) == 0)
+            farmBenchFrames=stoi(argument.substr(11));
+        else if(argument.rfind("-cheat=", 0) == 0)
+            options.cheats.push_back(argument.substr(7));
+        else if(argument.rfind("-overclock=", 0) == 0)
+            options.overclockLines=stoi(argument.substr(11));
+        else if(argument.rfind("-latency=", 0) == 0)
+            options.audioLatencyMs=stoi(argument.substr(9));
+        else if(argument.rfind("-filter=", 0) == 0)
+        {
+            if(!ParseUpscaleFilter(argument.substr(8), options.upscaleFilter))
+            {
+                cerr << "Unknown filter " << argument.substr(8) << ", use nearest, scale, xbr or ntsc\n";
+                return 11;
+            }
         }
+        else if(argument.rfind("-scale=", 0) == 0)
+            options.upscaleFactor=stoi(argument.substr(7));
+        else if(argument.rfind("-capture=", 0) == 0)
+            options.capturePath=argument.substr(9);
+        else if(argument == "-captureindices")
+            options.captureFormat=CAPTURE_INDICES;
+        else if(argument == "-stats")
+            options.printStats=true;
+        else if(argument.rfind("-record=", 0) == 0)
+            options.recordMovie=argument.substr(8);
+        else if(argument.rfind("-play=", 0) == 0)
+            options.playMovie=argument.substr(6);
+        else if(argument == "-noidleskip")
+            options.skipIdleLoops=false;
+    }
+
+    if(!UpscaleFactorSupported(options.upscaleFilter, options.upscaleFactor))
+    {
+        cerr << "The filter can't scale by " << options.upscaleFactor << ". nearest goes up to 8, scale takes 2 to 4 and xbr 2 or 4\n";
+        return 11;
     }
 
     if(romPath=="")
@@ -24,16 +71,31 @@ int main(int argc, char* argv[])
         cerr << "No rom path specified. use -p=<PATH TO ROM>\n";
         return 1;
     }
-    ifstream romFile(romPath, ifstream::basic_ios::binary);
-    if(!romFile.is_open())
+    filesystem::path filePath = romPath;
+
+    if(farmBenchFrames > 0)
+    {
+        RunFarmBenchmark(romPath, farmBenchFrames);
+        return 0;
+    }
+
+    if(lockstepFrames > 0)
+    {
+        LockstepExecutor lockstep(romPath, filePath.stem(), options);
+        return lockstep.Run(lockstepFrames) ? 0 : 6;
+    }
+
+    shared_ptr<const ROMImage> image = ROMImage::Open(romPath);
+    if(!image)
     {
         cerr << "Unable to read file " << romPath << '\n';
         return 2;
     }
-    
-    filesystem::path filePath = romPath;
 
-    NES nes(romFile, filePath.stem());
+    SDL_Init(SDL_INIT_EVERYTHING);
+    filesystem::create_directory("saves");
+
+    NES nes(image, filePath.stem(), options);
     nes.Run();
     SDL_Quit();
 }
@@ -1,8 +1,12 @@
+#pragma once
 #include <cstdint>
 #include <array>
 #include <fstream>
 #include <vector>
 #include <filesystem>
+#include <memory>
+#include <cstring>
+#include <atomic>
 
 struct Header
 {
@@ -18,9 +22,108 @@ struct Header
     bool isPAL;
 };
 
+//everything read from the rom file. loaded once and shared read-only by every instance running the game
+struct ROMImage
+{
+    Header header;
+    //point into the memory mapped file, or into storage when it had to be read
+    const uint8_t* PRG=nullptr;
+    size_t PRGsize=0;
+    //CHR ROM, or the zeroed initial contents of CHR RAM for carts without any
+    const uint8_t* CHR=nullptr;
+    size_t CHRsize=0;
+
+    //maps the file read-only, falling back to reading it where that fails. nullptr if it can't be opened
+    static std::shared_ptr<const ROMImage> Open(const std::string& path);
+    static std::shared_ptr<const ROMImage> Load(std::istream& romFile);
+
+    ROMImage() = default;
+    ROMImage(const ROMImage&) = delete;
+    ROMImage& operator=(const ROMImage&) = delete;
+    ~ROMImage();
+
+private:
+    //validates the header and trainer and points PRG and CHR at the data that follows
+    void Parse(const uint8_t* file, size_t size);
+
+    void* mapping=nullptr;
+    size_t mappingSize=0;
+    std::vector<uint8_t> storage;
+    std::vector<uint8_t> CHRRAM;
+};
+
+//value shared between a console and its forks until one of them writes to it
+template<typename T>
+class CopyOnWrite
+{
+public:
+    CopyOnWrite() : value(std::make_shared<T>()) {}
+
+    const T& Read() const { return *value; }
+
+    T& Write()
+    {
+        if(value.use_count() > 1)
+            value = std::make_shared<T>(*value);
+        else //the last other owner may have just copied it on another thread
+            std::atomic_thread_fence(std::memory_order_acquire);
+        return *value;
+    }
+
+private:
+    std::shared_ptr<T> value;
+};
+
+//CHR shared with the other instances until the first write, which gives this instance its own copy
+class CopyOnWriteCHR
+{
+public:
+    CopyOnWriteCHR() = default;
+    CopyOnWriteCHR(const CopyOnWriteCHR& other) { *this = other; }
+    CopyOnWriteCHR& operator=(const CopyOnWriteCHR& other)
+    {
+        image = other.image;
+        data = image ? image->CHR : nullptr;
+        copy.reset();
+        if(other.copy)
+        {
+            copy = std::make_unique<uint8_t[]>(image->CHRsize);
+            memcpy(copy.get(), other.copy.get(), image->CHRsize);
+            data = copy.get();
+        }
+        return *this;
+    }
+
+    void Init(std::shared_ptr<const ROMImage> sharedImage)
+    {
+        image = std::move(sharedImage);
+        data = image->CHR;
+    }
+
+    uint8_t Read(uint32_t address) const { return data[address]; }
+
+    void Write(uint32_t address, uint8_t value)
+    {
+        if(!copy)
+        {
+            copy = std::make_unique<uint8_t[]>(image->CHRsize);
+            memcpy(copy.get(), image->CHR, image->CHRsize);
+            data = copy.get();
+        }
+        copy[address] = value;
+    }
+
+private:
+    std::shared_ptr<const ROMImage> image;
+    const uint8_t* data=nullptr;
+    std::unique_ptr<uint8_t[]> copy;
+};
+
 class NESMapper
 {
 public:
+    virtual ~NESMapper() = default;
+
     virtual uint8_t ReadCPU(uint16_t address)=0;
     virtual void WriteCPU(uint16_t address, uint8_t value)=0;
 
@@ -28,6 +131,17 @@ public:
     virtual void WritePPU(uint16_t address, uint8_t value)=0;
 
     virtual void SaveGame()=0;
+    //8KB of cartridge RAM at $6000-$7FFF, null without any
+    virtual const uint8_t* GetSaveRAM() const { return nullptr; }
+    //copy of the mapper and all of its state, for snapshots
+    virtual std::unique_ptr<NESMapper> Clone() const=0;
+
+    //16KB PRG ROM bank currently visible at address, -1 where the CPU sees RAM or nothing cacheable
+    virtual int GetPRGBank(uint16_t /*address*/) { return -1; }
+    //bumped whenever the PRG banks visible to the CPU change
+    uint32_t PRGBankGeneration=0;
+    //bumped whenever the CHR banks or nametable layout the PPU sees change
+    uint32_t CHRBankGeneration=0;
 protected:
     enum NametableLayout
     {
@@ -58,7 +172,7 @@ protected:
 class NROM : public NESMapper
 {
 public:
-    NROM(std::ifstream &romFile, Header header);
+    NROM(std::shared_ptr<const ROMImage> image);
 
     uint8_t ReadCPU(uint16_t address) override;
     void WriteCPU(uint16_t address, uint8_t value) override;
@@ -67,16 +181,24 @@ public:
     void WritePPU(uint16_t address, uint8_t value) override;
 
     void SaveGame() override;
+    std::unique_ptr<NESMapper> Clone() const override { return std::make_unique<NROM>(*this); }
+
+    int GetPRGBank(uint16_t address) override;
 
 private:
-    uint8_t ROM[0x8000];
-    uint8_t VROM[0x4000];
+    std::shared_ptr<const ROMImage> image;
+    const uint8_t* PRG;
+    //16KB games are mirrored into both halves
+    uint16_t PRGmask;
+    CopyOnWriteCHR CHR;
+    //$2000-$3FFF after mirroring
+    CopyOnWrite<std::array<uint8_t, 0x2000>> nametableRAM;
 };
 
 class MMC1 : public NESMapper
 {
 public:
-    MMC1(std::ifstream &romFile, Header header, const std::string& saveName);
+    MMC1(std::shared_ptr<const ROMImage> image, const std::string& saveName);
 
     uint8_t ReadCPU(uint16_t address) override;
     void WriteCPU(uint16_t address, uint8_t value) override;
@@ -85,12 +207,19 @@ public:
     void WritePPU(uint16_t address, uint8_t value) override;
 
     void SaveGame() override;
+    std::unique_ptr<NESMapper> Clone() const override { return std::make_unique<MMC1>(*this); }
+    const uint8_t* GetSaveRAM() const override { return persistentMemory.Read().data(); }
+
+    int GetPRGBank(uint16_t address) override;
 private:
-    std::vector<std::array<char,0x4000>> ROMBanks;
-    std::vector<std::array<char,0x1000>> VROMBanks;
-    uint8_t PPUnametable1[0x400];
-    uint8_t PPUnametable2[0x400];
-    uint8_t persistentMemory[0x2000];    
+    std::shared_ptr<const ROMImage> image;
+    //16KB PRG banks and 4KB CHR banks, pointing into the shared image
+    const uint8_t* PRG;
+    int numPRGBanks;
+    CopyOnWriteCHR CHR;
+    CopyOnWrite<std::array<uint8_t, 0x400>> PPUnametable1;
+    CopyOnWrite<std::array<uint8_t, 0x400>> PPUnametable2;
+    CopyOnWrite<std::array<uint8_t, 0x2000>> persistentMemory;
 
     uint8_t nametableArrangement;
     uint8_t PRGmode=3;
@@ -110,7 +239,7 @@ private:
 class MMC3 : public NESMapper
 {
 public:
-    MMC3(std::ifstream &romFile, Header header, const std::string &saveName);
+    MMC3(std::shared_ptr<const ROMImage> image, const std::string &saveName);
 
     uint8_t ReadCPU(uint16_t address) override;
     void WriteCPU(uint16_t address, uint8_t value) override;
@@ -3,30 +3,20 @@
 #include <fstream>
 
 
-MMC1::MMC1(std::ifstream &romFile, Header header, const std::string& saveName)
+MMC1::MMC1(std::shared_ptr<const ROMImage> image, const std::string& saveName) : image(image)
 {
+    const Header& header = image->header;
     currentLayout = (header.is4ScreenVRAM ? FOUR_SCREEN : (header.isHorizontalArrangement ? HORIZONTAL : VERTICAL));
 
-    for (int i = 0; i < header.PRGROMsize; i++)
-    {
-        ROMBanks.emplace_back();
-        romFile.read(ROMBanks.back().data(), 0x4000);
-    }
-
+    PRG = image->PRG;
+    numPRGBanks = header.PRGROMsize;
+    CHR.Init(image);
     if(header.CHRROMsize == 0)
-    {//cartridge uses RAM. create 2 empty banks
-        VROMBanks.emplace_back();
-        VROMBanks.emplace_back();
+    {//cartridge uses RAM, the image holds 2 empty banks for it
         CHRBank0=0;
         CHRBank1=1;
     }
 
-    for (int i = 0; i < header.CHRROMsize*2; i++)
-    {
-        VROMBanks.emplace_back();
-        romFile.read(VROMBanks.back().data(), 0x1000);
-    }
-
     if(header.hasBatteryBackedRam)
     {
         hasPersistent=true;
@@ -35,12 +25,11 @@ MMC1::MMC1(std::ifstream &romFile, Header header, const std::string& saveName)
         if (!saveFile.is_open())
         {
             std::cout << "Unable to find save data at " << savePath << '\n';
-            for(int i=0; i<0x2000; i++)
-                persistentMemory[i]=0;
+            persistentMemory.Write().fill(0);
         }
         else
         {
-            saveFile.read((char*)persistentMemory, 0x2000);
+            saveFile.read((char*)persistentMemory.Write().data(), 0x2000);
         }
     }
 }
@@ -48,7 +37,7 @@ MMC1::MMC1(std::ifstream &romFile, Header header, const std::string& saveName)
 uint8_t MMC1::ReadCPU(uint16_t address)
 {
     if(address < 0x8000 && address>=0x6000)
-        return persistentMemory[address-0x6000];
+        return persistentMemory.Read()[address-0x6000];
 
     switch(PRGmode)
     {
@@ -56,19 +45,36 @@ uint8_t MMC1::ReadCPU(uint16_t address)
     case 1:
         address-=0x8000;
         if(address<0x4000)
-            return ROMBanks[PRGBank&0xFE][address];
+            return PRG[(PRGBank&0xFE) * 0x4000 + address];
         else
-            return ROMBanks[PRGBank|1][address-0x4000];
+            return PRG[(PRGBank|1) * 0x4000 + address-0x4000];
     case 2:
         if(address<0xC000)
-            return ROMBanks[0][address-0x8000];
+            return PRG[address - 0x8000];
         else
-            return ROMBanks[PRGBank][address-0xC000];
+            return PRG[PRGBank * 0x4000 + address-0xC000];
     case 3:
         if (address < 0xC000)
-            return ROMBanks[PRGBank][address - 0x8000];
+            return PRG[PRGBank * 0x4000 + address - 0x8000];
         else
-            return ROMBanks.back()[address - 0xC000];
+            return PRG[(numPRGBanks - 1) * 0x4000 + address - 0xC000];
+    }
+}
+
+int MMC1::GetPRGBank(uint16_t address)
+{
+    if(address < 0x8000)
+        return -1;
+
+    switch(PRGmode)
+    {
+    case 0:
+    case 1:
+        return address < 0xC000 ? PRGBank & 0xFE : PRGBank | 1;
+    case 2:
+        return address < 0xC000 ? 0 : PRGBank;
+    default:
+        return address < 0xC000 ? PRGBank : numPRGBanks - 1;
     }
 }
 
@@ -76,7 +82,7 @@ void MMC1::WriteCPU(uint16_t address, uint8_t value)
 {
     if (address < 0x8000 && address >= 0x6000)
     {
-        persistentMemory[address - 0x6000] = value;
+        persistentMemory.Write()[address - 0x6000] = value;
         return;
     }
 
@@ -85,6 +91,7 @@ void MMC1::WriteCPU(uint16_t address, uint8_t value)
         shiftReg=0;
         shiftCount=0;
         PRGmode=3;
+        PRGBankGeneration++;
         return;
     }
 
@@ -110,15 +117,20 @@ void MMC1::WriteCPU(uint16_t address, uint8_t value)
             }
             PRGmode=(shiftReg&0b1100) >> 2;
             CHRmode = shiftReg & 0b10000;
+            PRGBankGeneration++;
+            CHRBankGeneration++;
         break;
         case 1:
             CHRBank0=shiftReg;
+            CHRBankGeneration++;
         break;
         case 2:
             CHRBank1=shiftReg;
+            CHRBankGeneration++;
         break;
         case 3:
             PRGBank=shiftReg;
+            PRGBankGeneration++;
         }
         shiftCount=0;
         shiftReg=0;
@@ -133,34 +145,34 @@ uint8_t MMC1::ReadPPU(uint16_t address)
         switch(nametableArrangement)
         {
         case 0:
-            return PPUnametable1[address & 0x3FF];
+            return PPUnametable1.Read()[address & 0x3FF];
         case 1:
-            return PPUnametable2[address & 0x3FF];
+            return PPUnametable2.Read()[address & 0x3FF];
         case 2:
             if(address < 0x2400)
-                return PPUnametable1[address & 0x3FF];
+                return PPUnametable1.Read()[address & 0x3FF];
             else
-                return PPUnametable2[address & 0x3FF];
+                return PPUnametable2.Read()[address & 0x3FF];
         case 3:
             if (address < 0x2400) 
-                return PPUnametable1[address & 0x3FF];
+                return PPUnametable1.Read()[address & 0x3FF];
             else 
-                return PPUnametable2[address & 0x3FF];
+                return PPUnametable2.Read()[address & 0x3FF];
         }
     }
 
     if(CHRmode)
     {
         if(address<0x1000)
-            return VROMBanks[CHRBank0][address];
+            return CHR.Read(CHRBank0 * 0x1000 + address);
         else
-            return VROMBanks[CHRBank1][address-0x1000];
+            return CHR.Read(CHRBank1 * 0x1000 + address-0x1000);
     }
 
     if (address < 0x1000)
-        return VROMBanks[CHRBank0 & 0xFE][address];
+        return CHR.Read((CHRBank0 & 0xFE) * 0x1000 + address);
     else
-        return VROMBanks[CHRBank0 | 1][address - 0x1000];
+        return CHR.Read((CHRBank0 | 1) * 0x1000 + address - 0x1000);
 }
 
 void MMC1::WritePPU(uint16_t address, uint8_t value)
@@ -170,16 +182,16 @@ void MMC1::WritePPU(uint16_t address, uint8_t value)
         if (CHRmode)
         {
             if (address < 0x1000)
-                VROMBanks[CHRBank0][address] = value;
+                CHR.Write(CHRBank0 * 0x1000 + address, value);
             else
-                VROMBanks[CHRBank1][address - 0x1000] = value;
+                CHR.Write(CHRBank1 * 0x1000 + address - 0x1000, value);
         }
         else
         {
             if (address < 0x1000)
-                VROMBanks[CHRBank0 & 0xFE][address] = value;
+                CHR.Write((CHRBank0 & 0xFE) * 0x1000 + address, value);
             else
-                VROMBanks[CHRBank0 | 1][address - 0x1000] = value;
+                CHR.Write((CHRBank0 | 1) * 0x1000 + address - 0x1000, value);
         }
         return;
     }
@@ -188,19 +200,19 @@ void MMC1::WritePPU(uint16_t address, uint8_t value)
     switch (nametableArrangement)
     {
     case 0:
-        PPUnametable1[address & 0x3FF] = value;
+        PPUnametable1.Write()[address & 0x3FF] = value;
     case 1:
-        PPUnametable2[address & 0x3FF] = value;
+        PPUnametable2.Write()[address & 0x3FF] = value;
     case 2:
         if (address < 0x2400)
-            PPUnametable1[address & 0x3FF] = value;
+            PPUnametable1.Write()[address & 0x3FF] = value;
         else
-            PPUnametable2[address & 0x3FF] = value;
+            PPUnametable2.Write()[address & 0x3FF] = value;
     case 3:
         if (address < 0x2400)
-            PPUnametable1[address & 0x3FF] = value;
+            PPUnametable1.Write()[address & 0x3FF] = value;
         else
-            PPUnametable2[address & 0x3FF] = value;
+            PPUnametable2.Write()[address & 0x3FF] = value;
     }
     
 }
@@ -210,7 +222,7 @@ void MMC1::SaveGame()
     if(!hasPersistent)
         return;
     std::ofstream saveFile(savePath, std::ifstream::basic_ios::binary);
-    saveFile.write((char*)persistentMemory, 0x2000);
+    saveFile.write((char*)persistentMemory.Read().data(), 0x2000);
     if(saveFile.bad())
         std::cerr << "Failed to write save data to " << savePath.string() << "\n";
     else
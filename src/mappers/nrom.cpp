@@ -2,27 +2,32 @@
 #include <string.h>
 #include <iostream>
 
-NROM::NROM(std::ifstream &romFile, Header header)
+NROM::NROM(std::shared_ptr<const ROMImage> image) : image(image)
 {
+    const Header& header = image->header;
     currentLayout = (header.is4ScreenVRAM ? FOUR_SCREEN : (header.isHorizontalArrangement ? HORIZONTAL : VERTICAL));
 
-    for (int i = 0; i < header.PRGROMsize; i++)
-        romFile.read((char*)ROM + i*0x4000, 0x4000);
-    if (header.PRGROMsize == 1)
-        memcpy(ROM + 0x4000, ROM, 0x4000);
-
     if(header.CHRROMsize!=1)
     {//TODO 0 might mean it's ram
         std::cerr << "NROM file does not have correct CHRROM size\n";
         exit(14);
     }
 
-    romFile.read((char *)VROM, 0x2000);
+    PRG = image->PRG;
+    PRGmask = header.PRGROMsize == 1 ? 0x3FFF : 0x7FFF;
+    CHR.Init(image);
 }
 
 uint8_t NROM::ReadCPU(uint16_t address)
 {
-    return ROM[address-0x8000];
+    return PRG[(address - 0x8000) & PRGmask];
+}
+
+int NROM::GetPRGBank(uint16_t address)
+{
+    if(address < 0x8000)
+        return -1;
+    return ((address - 0x8000) & PRGmask) / 0x4000;
 }
 
 void NROM::WriteCPU(uint16_t address, uint8_t value)
@@ -33,13 +38,18 @@ void NROM::WriteCPU(uint16_t address, uint8_t value)
 uint8_t NROM::ReadPPU(uint16_t address)
 {
     address=GetRealNameTable(address);
-    return VROM[address];
+    if(address < 0x2000)
+        return CHR.Read(address);
+    return nametableRAM.Read()[address - 0x2000];
 }
 
 void NROM::WritePPU(uint16_t address, uint8_t value)
 {
     address = GetRealNameTable(address);
-    VROM[address]=value;
+    if(address < 0x2000)
+        CHR.Write(address, value);
+    else
+        nametableRAM.Write()[address - 0x2000] = value;
 }
 
 void NROM::SaveGame()
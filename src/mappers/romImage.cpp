@@ -0,0 +1,112 @@
+#include "mapper.h"
+#include <iostream>
+#include <iterator>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+std::shared_ptr<const ROMImage> ROMImage::Open(const std::string& path)
+{
+#ifndef _WIN32
+    int file = open(path.c_str(), O_RDONLY);
+    if(file < 0)
+        return nullptr;
+
+    struct stat info;
+    void* mapping = MAP_FAILED;
+    if(fstat(file, &info) == 0 && info.st_size > 0)
+        mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    //the mapping keeps the file alive on its own
+    close(file);
+
+    if(mapping != MAP_FAILED)
+    {
+        auto image = std::make_shared<ROMImage>();
+        image->mapping = mapping;
+        image->mappingSize = info.st_size;
+        image->Parse((const uint8_t*)mapping, info.st_size);
+        return image;
+    }
+#endif
+
+    std::ifstream romFile(path, std::ifstream::basic_ios::binary);
+    if(!romFile.is_open())
+        return nullptr;
+    return Load(romFile);
+}
+
+std::shared_ptr<const ROMImage> ROMImage::Load(std::istream& romFile)
+{
+    auto image = std::make_shared<ROMImage>();
+    image->storage.assign(std::istreambuf_iterator<char>(romFile), std::istreambuf_iterator<char>());
+    image->Parse(image->storage.data(), image->storage.size());
+    return image;
+}
+
+ROMImage::~ROMImage()
+{
+#ifndef _WIN32
+    if(mapping)
+        munmap(mapping, mappingSize);
+#endif
+}
+
+void ROMImage::Parse(const uint8_t* file, size_t size)
+{
+    const uint8_t* magicBytes = file;
+    if (size < 16 || !(magicBytes[0] == 0x4E && magicBytes[1] == 0x45 && magicBytes[2] == 0x53 && magicBytes[3] == 0x1A))
+    {
+        std::cerr << "Invalid header\n";
+        exit(3);
+    }
+
+    header.PRGROMsize = file[4];
+    header.CHRROMsize = file[5];
+
+    uint8_t flags6 = file[6];
+    header.isHorizontalArrangement = flags6 & 1;
+    header.hasBatteryBackedRam = flags6 & 0b10;
+    header.hasTrainer = flags6 & 0b100;
+    header.is4ScreenVRAM = flags6 & 0b1000;
+
+    uint8_t flags7 = file[7];
+    header.isVSsystem = flags7 & 1;
+    header.mapperType = ((flags6 >> 4) & 0x0F) | (flags7 & 0xF0);
+
+    header.RAMsize = file[8];
+    if (header.RAMsize == 0)
+        header.RAMsize = 1;
+
+    uint8_t flags9 = file[9];
+    header.isPAL = flags9 & 1;
+
+    //bytes 10-15 are unused
+    size_t offset = 16;
+    if (header.hasTrainer)
+    {
+        std::cout << "Warning: ROM file indicates it includes a 512 Byte trainer. This is rare and untested on this emulator\n";
+        //$7000 belongs to the cartridge, the CPU never saw the trainer here so it is just skipped
+        offset += 512;
+    }
+
+    PRGsize = header.PRGROMsize * 0x4000;
+    CHRsize = header.CHRROMsize * 0x2000;
+    if (offset + PRGsize + CHRsize > size)
+    {
+        std::cerr << "Error while reading file\n";
+        exit(4);
+    }
+
+    PRG = file + offset;
+    CHR = file + offset + PRGsize;
+    //carts without CHR ROM get 8KB of RAM, which starts out zeroed
+    if (header.CHRROMsize == 0)
+    {
+        CHRRAM.resize(0x2000);
+        CHR = CHRRAM.data();
+        CHRsize = CHRRAM.size();
+    }
+}
@@ -2,6 +2,25 @@
 #include <iomanip>
 #include <sstream>
 
+void NES::SetControllerState(int player, uint8_t buttons)
+{
+    ControllerData& state = player == 0 ? currentStatePlayer1 : currentStatePlayer2;
+    state.A = buttons & 1;
+    state.B = buttons & 2;
+    state.select = buttons & 4;
+    state.start = buttons & 8;
+    state.up = buttons & 0x10;
+    state.down = buttons & 0x20;
+    state.left = buttons & 0x40;
+    state.right = buttons & 0x80;
+}
+
+uint8_t NES::GetControllerState(int player) const
+{
+    const ControllerData& state = player == 0 ? currentStatePlayer1 : currentStatePlayer2;
+    return state.A | state.B << 1 | state.select << 2 | state.start << 3 | state.up << 4 | state.down << 5 | state.left << 6 | state.right << 7;
+}
+
 uint8_t NES::GetPlayer1Bit()
 {
     if(strobingControllers) return currentStatePlayer1.A ? 1 : 0;
@@ -59,17 +78,23 @@ uint8_t NES::Read8Bit(uint16_t address, bool incrementPC)
         registers.programCounter++;
 
     //mirrored RAM
-    if(address < 0x2000) return nesMemory[address % 0x0800];
+    if(address < 0x2000) return RAM[address % 0x0800];
     
     //mirrored PPU registers
     if(address < 0x4000) 
+    {
+        //polling $2002 is the only register read an idle loop may contain
+        if(address % 8 != 2)
+            idleLoop.clean = false;
         return PPUHandleRegRead(address%8);
-    
-        
+    }
 
     //IO registers
     if(address<0x4020) 
     {
+        idleLoop.clean = false;
+        if(address == 0x4016 || address == 0x4017)
+            inputPolled = true;
         switch(address-0x4000)
         {
         case 0x16: return GetPlayer1Bit();
@@ -79,24 +104,51 @@ uint8_t NES::Read8Bit(uint16_t address, bool incrementPC)
         }
     }
 
+    if(cheatsActive)
+        return ReadCheatedPRG(address);
     return mapper->ReadCPU(address);
 }
 
+uint8_t NES::FetchOperand8()
+{
+    if(decodedOperand)
+    {
+        registers.programCounter++;
+        return *decodedOperand++;
+    }
+    return Read8Bit(registers.programCounter, true);
+}
+
+uint16_t NES::FetchOperand16()
+{
+    uint8_t lowByte = FetchOperand8();
+    uint8_t highByte = FetchOperand8();
+    return ((uint16_t)highByte<<8) | lowByte;
+}
+
 void NES::Write8Bit(uint16_t address, uint8_t value)
 {
+    if(writeLog)
+        writeLog->emplace_back(address, value);
+    idleLoop.clean = false;
+
     if(address < 0x2000) 
-        nesMemory[address%0x0800] = value;
+    {
+        RAM[address%0x0800] = value;
+        dirtyRAMPages |= 1 << ((address % 0x0800) >> 8);
+    }
     else if(address < 0x4000)
     {
         
         address%=8;
-        nesMemory[address+0x2000]=value;
+        PPUregisterShadow[address]=value;
         PPUHandleRegisterWrite(address, value);
+        PPUwritten = true;
     }
     else if(address== 0x4014)
     {
-        nesMemory[address] = value;
         PPUHandleRegisterWrite(address-0x4000, value);
+        PPUwritten = true;
     }
     else if(address < 0x4020)
     {
@@ -115,7 +167,12 @@ void NES::Write8Bit(uint16_t address, uint8_t value)
             strobingControllers = doStrobe;
         }
         else if(address < 0x18)
-            APUHandleRegisterWrite(address, value);
+        {
+            if(header.isPAL)
+                APUHandleRegisterWrite<PAL>(address, value);
+            else
+                APUHandleRegisterWrite<NTSC>(address, value);
+        }
         
     }
     else
@@ -132,7 +189,11 @@ void NES::PushStack16Bit(uint16_t value)
 
 void NES::PushStack8Bit(uint8_t value)
 {
-    nesMemory[registers.stackPointer + 0x100] = value;
+    if(writeLog)
+        writeLog->emplace_back(registers.stackPointer + 0x100, value);
+    idleLoop.clean = false;
+    RAM[registers.stackPointer + 0x100] = value;
+    dirtyRAMPages |= 0b10;
     registers.stackPointer--;
     //std::cout << "SP: " << std::setfill('0') << std::setw(2) << std::hex << ((uint16_t)registers.stackPointer & 0xff) << "\n";
     //std::cout << "added value: " << std::setfill('0') << std::setw(2) << std::hex << ((uint16_t)value & 0xff) << "\n";
@@ -149,6 +210,6 @@ uint8_t NES::PullStack8Bit()
 {
     registers.stackPointer++;
     //std::cout << "SP: " << std::setfill('0') << std::setw(2) << std::hex <<((uint16_t)registers.stackPointer& 0xff)<< "\n";
-    //std::cout << "removed value: " << std::setfill('0') << std::setw(2) << std::hex << ((uint16_t)nesMemory[registers.stackPointer + 0x100]& 0xff) << "\n";
-    return nesMemory[registers.stackPointer + 0x100];
+    //std::cout << "removed value: " << std::setfill('0') << std::setw(2) << std::hex << ((uint16_t)RAM[registers.stackPointer + 0x100]& 0xff) << "\n";
+    return RAM[registers.stackPointer + 0x100];
 }
@@ -0,0 +1,35 @@
+#include "movie.h"
+#include <iomanip>
+
+bool Movie::Record(const std::string& path)
+{
+    output.open(path);
+    recording = output.is_open();
+    return recording;
+}
+
+bool Movie::Play(const std::string& path)
+{
+    input.open(path);
+    playing = input.is_open();
+    return playing;
+}
+
+void Movie::AddFrame(uint8_t player1, uint8_t player2, bool lagged)
+{
+    output << std::hex << std::setfill('0') << std::setw(2) << (int)player1 << ' ' << std::setw(2) << (int)player2 << ' ' << (lagged ? 'L' : '.') << '\n';
+}
+
+bool Movie::NextFrame(uint8_t& player1, uint8_t& player2)
+{
+    std::string line;
+    unsigned int first, second;
+    if(!playing || !std::getline(input, line) || sscanf(line.c_str(), "%x %x", &first, &second) != 2)
+    {
+        playing = false;
+        return false;
+    }
+    player1 = first;
+    player2 = second;
+    return true;
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+//input recording, one text line per frame: player 1 and player 2 buttons in hex (SetControllerState's layout)
+//followed by L for a lag frame or . otherwise
+class Movie
+{
+public:
+    bool Record(const std::string& path);
+    bool Play(const std::string& path);
+    bool IsRecording() const { return recording; }
+    bool IsPlaying() const { return playing; }
+
+    void AddFrame(uint8_t player1, uint8_t player2, bool lagged);
+    //buttons for the next frame, false once the movie has ended
+    bool NextFrame(uint8_t& player1, uint8_t& player2);
+
+private:
+    std::ofstream output;
+    std::ifstream input;
+    bool recording=false;
+    bool playing=false;
+};
@@ -1,91 +1,51 @@
 #include "nes.h"
+#include "opcodes.h"
 #include <chrono>
 #include <thread>
 #include <iomanip>
 #include <sstream>
+#include <algorithm>
 using namespace std;
 
-void NES::ParseHeader(ifstream &romFile)
+void NES::InitMemory(std::shared_ptr<const ROMImage> image, string name)
 {
-    char magicBytes[4];
-    romFile.read(magicBytes, 4);
-
-    if (!(magicBytes[0] == 0x4E && magicBytes[1] == 0x45 && magicBytes[2] == 0x53 && magicBytes[3] == 0x1A))
-    {
-        cerr << "Invalid header\n";
-        exit(3);
-    }
-
-    romFile.read((char *)&header.PRGROMsize, 1);
-    romFile.read((char *)&header.CHRROMsize, 1);
-
-    char flags6;
-    romFile.read(&flags6, 1);
-    header.isHorizontalArrangement = flags6 & 1;
-    header.hasBatteryBackedRam = flags6 & 0b10;
-    header.hasTrainer = flags6 & 0b100;
-    header.is4ScreenVRAM = flags6 & 0b1000;
-
-    char flags7;
-    romFile.read(&flags7, 1);
-    header.isVSsystem = flags7 & 1;
-    header.mapperType = ((flags6 >> 4) & 0x0F) | (flags7 & 0xF0);
-
-    romFile.read((char *)&header.RAMsize, 1);
-    if (header.RAMsize == 0)
-        header.RAMsize = 1;
-
-    char flags9;
-    romFile.read(&flags9, 1);
-    header.isPAL = flags9 & 1;
-
-    char unusedData[6];
-    romFile.read(unusedData, 6);
-}
-
-void NES::InitMemory(ifstream &romFile, string name)
-{
-    if (header.hasTrainer)
-    {
-        cout << "Warning: ROM file indicates it includes a 512 Byte trainer. This is rare and untested on this emulator\n";
-        romFile.read(nesMemory + 0x7000, 512);
-    }
-
     switch(header.mapperType)
     {
     case 0:
-        mapper = make_unique<NROM>(romFile, header);
+        mapper = make_unique<NROM>(image);
     break;
     case 1:
-        mapper = make_unique<MMC1>(romFile, header, name);
+        mapper = make_unique<MMC1>(image, name);
     break;
     default:
         cerr << "Mapper not supported: " << (int)header.mapperType << "\n";
         exit(5);
     }
-    
-    if (romFile.fail())
-    {
-        cerr << "Error while reading file\n";
-        exit(4);
-    }
+    blockCache.SetImage(image.get());
 
     if(header.isPAL)
-    {
-        numVBlankLines=72;
-        numTotalLines=312;
-        msPerFrame=20;
-        DMC.frequencyDecoded = 398;
-    }
+        InitRegion<PAL>();
     else
+        InitRegion<NTSC>();
+    registers.programCounter = Read16Bit(0xFFFC, false);
+}
+
+template<typename Region>
+void NES::InitRegion()
+{
+    scanline = 0;
+    DMC.frequencyDecoded = Region::DMCrates[0];
+    frameIndices.Write().assign(256 * Region::visibleLines, 0);
+    framebufferStale = true;
+    if(options.observationFormat != OBSERVATION_RGBA)
     {
-        numVBlankLines=30;
-        numTotalLines=262;
-        msPerFrame=16.66666;
-        scanline=8;
-        DMC.frequencyDecoded = 428;
+        for(auto& frame : observationFrames)
+            frame.Write().assign(GetObservationWidth() * GetObservationHeight(), 0);
     }
-    registers.programCounter = Read16Bit(0xFFFC, false);
+
+    //the first line ends once a full line of cycles has passed
+    scheduler.Schedule(EVENT_SCANLINE_END, PPUcyclesPerLine + 1);
+    ScheduleAPUFrameStep<Region>(1);
 }
 
 void UpdateAudioBuffer(void* userdata, Uint8* stream, int len)
@@ -94,26 +54,37 @@ void UpdateAudioBuffer(void* userdata, Uint8* stream, int len)
     cast->SDLAudioCallback(stream, len);
 }
 
+void NES::StartCapture()
+{
+    int samplesPerFrame = header.isPAL ? PAL::samplesPerFrame : NTSC::samplesPerFrame;
+    if(!frontend->capture.Start(options.capturePath, options.captureFormat, 256, GetFrameHeight(), samplesPerFrame, RGBAPalette.data()))
+    {
+        std::cerr << "Unable to write capture " << options.capturePath << "\n";
+        exit(12);
+    }
+}
+
 void NES::InitSDL()
 {
-    win = SDL_CreateWindow("NES Emulator", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, 256 * 4, header.isPAL ? 240 * 4 : 224 * 4, SDL_WINDOW_SHOWN);
-    if (!win)
+    frontend->win = SDL_CreateWindow("NES Emulator", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, 256 * 4, header.isPAL ? 240 * 4 : 224 * 4, SDL_WINDOW_SHOWN);
+    if (!frontend->win)
     {
         std::cerr << "failed to create SDL window: " << SDL_GetError() << "\n";
         exit(9);
     }
-    renderer = SDL_CreateRenderer(win, -1, SDL_RENDERER_ACCELERATED);
-    if (!renderer)
+    frontend->stretchRect.x=0;
+    frontend->stretchRect.y=0;
+    frontend->stretchRect.w=256*4;
+    frontend->stretchRect.h = (header.isPAL ? 240 : 224)*4;
+    //the PAL signal alternates its colour phase every line, which the NTSC decoder doesn't model
+    if(options.upscaleFilter == UPSCALE_NTSC && header.isPAL)
     {
-        std::cerr << "failed to create SDL renderer: " << SDL_GetError() << "\n";
-        exit(10);
+        std::cerr << "The NTSC filter doesn't apply to PAL games, showing the picture unfiltered\n";
+        options.upscaleFilter = UPSCALE_NONE;
     }
-    nesTexture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STREAMING, 256, header.isPAL ? 240 : 224);
-    nesPixels = make_unique<uint32_t[]>(256* (header.isPAL ? 240 : 224));
-    stretchRect.x=0;
-    stretchRect.y=0;
-    stretchRect.w=256*4;
-    stretchRect.h = (header.isPAL ? 240 : 224)*4;
+    if(!frontend->presenter.Start(frontend->win, 256, header.isPAL ? 240 : 224, frontend->stretchRect, RGBAPalette.data(),
+                                  options.upscaleFilter, options.upscaleFactor))
+        exit(10);
     /*
     debugWin = SDL_CreateWindow("NES Emulator debug window", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, 256 * 4, 240*4, SDL_WINDOW_SHOWN);
     if (!debugWin)
@@ -130,21 +101,22 @@ void NES::InitSDL()
     debugnesTexture = SDL_CreateTexture(debugRenderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STREAMING, 512, 480);
     debugnesPixels = make_unique<uint32_t[]>(256 * 240 * 4);
     */
-    SDL_memset(&want, 0, sizeof(want));
-    want.freq=48000;
-    want.format=AUDIO_S16SYS;
-    want.channels=1;
-    want.samples=512;
-    want.userdata = this;
-    want.callback = UpdateAudioBuffer;
-
-    device = SDL_OpenAudioDevice(NULL, 0, &want, &have, 0);
-    if (device == 0)
+    SDL_memset(&frontend->want, 0, sizeof(frontend->want));
+    frontend->want.freq=48000;
+    frontend->want.format=AUDIO_S16SYS;
+    frontend->want.channels=1;
+    frontend->pacer.SetLatency(options.audioLatencyMs);
+    frontend->want.samples=frontend->pacer.DeviceSamples();
+    frontend->want.userdata = this;
+    frontend->want.callback = UpdateAudioBuffer;
+
+    frontend->device = SDL_OpenAudioDevice(NULL, 0, &frontend->want, &frontend->have, 0);
+    if (frontend->device == 0)
     {
         std::cerr << "failed to create SDL audio device: " << SDL_GetError() << "\n";
         exit(20);
     }
-    SDL_PauseAudioDevice(device, 0);
+    SDL_PauseAudioDevice(frontend->device, 0);
 }
 
 uint16_t NES::GetOperandAddress(AddressMode addressMode)
@@ -153,22 +125,22 @@ uint16_t NES::GetOperandAddress(AddressMode addressMode)
     switch (addressMode)
     {
     case ACCUMULATOR: return 0;
-    case ABSOLUTE: return Read16Bit(registers.programCounter, true);
-    case ABSOLUTE_X_INDEX: return Read16Bit(registers.programCounter, true) + registers.Xregister;
-    case ABSOLUTE_Y_INDEX: return Read16Bit(registers.programCounter, true) + registers.Yregister;
+    case ABSOLUTE: return FetchOperand16();
+    case ABSOLUTE_X_INDEX: return FetchOperand16() + registers.Xregister;
+    case ABSOLUTE_Y_INDEX: return FetchOperand16() + registers.Yregister;
     case IMMEDIATE: return 0;
     case IMPLIED: return 0;
-    case INDIRECT: return Read16Bit(registers.programCounter, true);
+    case INDIRECT: return FetchOperand16();
     case INDIRECT_X_INDEX:
-        address = (Read8Bit(registers.programCounter, true) + registers.Xregister) % 256;
+        address = (FetchOperand8() + registers.Xregister) % 256;
         return Read16BitWrapAround(address);
     case INDIRECT_Y_INDEX:
-        address = Read8Bit(registers.programCounter, true);
+        address = FetchOperand8();
         return Read16BitWrapAround(address) + registers.Yregister;
-    case RELATIVE:return Read8Bit(registers.programCounter, true);
-    case ZEROPAGE: return Read8Bit(registers.programCounter, true);
-    case ZEROPAGE_X_INDEX: return (Read8Bit(registers.programCounter, true) + registers.Xregister) % 256;
-    case ZEROPAGE_Y_INDEX: return (Read8Bit(registers.programCounter, true) + registers.Yregister) % 256;
+    case RELATIVE:return FetchOperand8();
+    case ZEROPAGE: return FetchOperand8();
+    case ZEROPAGE_X_INDEX: return (FetchOperand8() + registers.Xregister) % 256;
+    case ZEROPAGE_Y_INDEX: return (FetchOperand8() + registers.Yregister) % 256;
     }
     return -1;
 }
@@ -181,37 +153,37 @@ std::pair<uint16_t, uint16_t> NES::GetOperandAddressValue(AddressMode addressMod
     case ACCUMULATOR:
         return pair<uint16_t,uint16_t>(registers.accumulator,0);
     case ABSOLUTE:
-        address = Read16Bit(registers.programCounter, true);
+        address = FetchOperand16();
         return pair<uint16_t,uint16_t>(Read8Bit(address, false), address);
     case ABSOLUTE_X_INDEX: 
-        address = Read16Bit(registers.programCounter, true) + registers.Xregister;
+        address = FetchOperand16() + registers.Xregister;
         return pair<uint16_t, uint16_t>(Read8Bit(address, false), address);
     case ABSOLUTE_Y_INDEX:
-        address = Read16Bit(registers.programCounter, true) + registers.Yregister;
+        address = FetchOperand16() + registers.Yregister;
         return pair<uint16_t, uint16_t>(Read8Bit(address, false), address);
-    case IMMEDIATE: return pair<uint16_t,uint16_t>(Read8Bit(registers.programCounter, true),0);
+    case IMMEDIATE: return pair<uint16_t,uint16_t>(FetchOperand8(),0);
     case IMPLIED: return pair<uint16_t,uint16_t>(0,0);
     case INDIRECT:
-        address = Read16Bit(registers.programCounter, true);
+        address = FetchOperand16();
         return pair<uint16_t, uint16_t>(Read16BitWrapAround(address), address);
     case INDIRECT_X_INDEX:
-        address = (Read8Bit(registers.programCounter, true) + registers.Xregister) % 256;
+        address = (FetchOperand8() + registers.Xregister) % 256;
         address = Read16BitWrapAround(address);
         return pair<uint16_t, uint16_t>(Read8Bit(address, false), address);
     case INDIRECT_Y_INDEX:
-        address = Read8Bit(registers.programCounter, true);
+        address = FetchOperand8();
         address = Read16BitWrapAround(address) + registers.Yregister;
         return pair<uint16_t, uint16_t>(Read16Bit(address, false), address);
     case RELATIVE:
-        return pair<uint16_t, uint16_t>(Read8Bit(registers.programCounter, true),0);
+        return pair<uint16_t, uint16_t>(FetchOperand8(),0);
     case ZEROPAGE:
-        address = Read8Bit(registers.programCounter, true) & 0xFF;
+        address = FetchOperand8() & 0xFF;
         return pair<uint16_t, uint16_t>(Read8Bit(address, false), address);
     case ZEROPAGE_X_INDEX:
-        address = (Read8Bit(registers.programCounter, true)+registers.Xregister)%256;
+        address = (FetchOperand8()+registers.Xregister)%256;
         return pair<uint16_t, uint16_t>(Read8Bit(address, false), address);
     case ZEROPAGE_Y_INDEX:
-        address = (Read8Bit(registers.programCounter, true) + registers.Yregister) % 256;
+        address = (FetchOperand8() + registers.Yregister) % 256;
         return pair<uint16_t, uint16_t>(Read8Bit(address, false), address);
     }
     return pair<uint16_t,uint16_t>(-1,-1);
@@ -219,6 +191,14 @@ std::pair<uint16_t, uint16_t> NES::GetOperandAddressValue(AddressMode addressMod
 
 void NES::SetProcessorStatusFlag(int bitNum, bool set)
 {
+    switch(bitNum)
+    {
+    case CARRY: registers.carry = set; return;
+    case ZERO: registers.zeroResult = set ? 0 : 1; return;
+    case OVERFLOW: registers.overflow = set; return;
+    case NEGATIVE: registers.negativeResult = set ? 0b10000000 : 0; return;
+    }
+
     uint8_t setBit = 1 << bitNum;
     uint8_t mask = ~setBit;
     if(set)
@@ -229,13 +209,35 @@ void NES::SetProcessorStatusFlag(int bitNum, bool set)
 
 uint8_t NES::GetProcessorStatusFlag(int bitNum)
 {
+    switch(bitNum)
+    {
+    case CARRY: return registers.carry ? 1 : 0;
+    case ZERO: return registers.zeroResult == 0 ? 0b10 : 0;
+    case OVERFLOW: return registers.overflow ? 0b1000000 : 0;
+    case NEGATIVE: return registers.negativeResult & 0b10000000;
+    }
     return registers.processorStatus & (1 << bitNum);
 }
 
+uint8_t NES::GetProcessorStatus()
+{
+    return registers.processorStatus | GetProcessorStatusFlag(CARRY) | GetProcessorStatusFlag(ZERO) |
+           GetProcessorStatusFlag(OVERFLOW) | GetProcessorStatusFlag(NEGATIVE);
+}
+
+void NES::SetProcessorStatus(uint8_t value)
+{
+    registers.processorStatus = value & 0b00111100;
+    registers.carry = value & 1;
+    registers.zeroResult = (value & 0b10) ? 0 : 1;
+    registers.overflow = value & 0b1000000;
+    registers.negativeResult = value & 0b10000000;
+}
+
 void NES::UpdateZeroAndNegativeFlags(uint16_t result)
 {
-    SetProcessorStatusFlag(ZERO, (result & 0xFF)==0);
-    SetProcessorStatusFlag(NEGATIVE, result & 0b10000000);
+    registers.zeroResult = result;
+    registers.negativeResult = result;
 }
 
 void NES::break6502()
@@ -245,104 +247,137 @@ void NES::break6502()
         PushStack16Bit(registers.programCounter+1);
         SetProcessorStatusFlag(BREAK, true);
         registers.processorStatus |= 0b100000;
-        PushStack8Bit(registers.processorStatus);
+        PushStack8Bit(GetProcessorStatus());
         registers.programCounter = Read16Bit(0xFFFE, false);
     }
-    PPUcycles+=21;
 }
 
 void NES::or6502(uint8_t value)
 {
     registers.accumulator |= value;
     UpdateZeroAndNegativeFlags(registers.accumulator);
-    PPUcycles+=6;
 }
 
 void NES::and6502(uint8_t value)
 {
     registers.accumulator &= value;
     UpdateZeroAndNegativeFlags(registers.accumulator);
-    PPUcycles += 6;
 }
 
 void NES::eor6502(uint8_t value)
 {
     registers.accumulator ^= value;
     UpdateZeroAndNegativeFlags(registers.accumulator);
-    PPUcycles += 6;
 }
 
 void NES::bit6502(uint8_t value)
 {
-    SetProcessorStatusFlag(ZERO, (registers.accumulator & value) ==0);
-    SetProcessorStatusFlag(OVERFLOW, value & 0b1000000);
-    SetProcessorStatusFlag(NEGATIVE, value & 0b10000000);
-    PPUcycles += 9;
+    registers.zeroResult = registers.accumulator & value;
+    registers.overflow = value & 0b1000000;
+    registers.negativeResult = value;
 }
 
 void NES::shift6502(bool left, bool rotate, bool acc, std::pair<uint16_t, uint16_t> valueAddress)
 {
-    bool oldCarry = GetProcessorStatusFlag(CARRY);
+    bool oldCarry = registers.carry;
     uint8_t value = valueAddress.first;
-    SetProcessorStatusFlag(CARRY, (left ? (value & 0b10000000) : (value & 1)));
+    registers.carry = left ? (value & 0b10000000) : (value & 1);
     value = left ? (value << 1) : (value >> 1);
     if (oldCarry && rotate)
         value |= (left ? 1 : 0b10000000);
     UpdateZeroAndNegativeFlags(value);
     if(acc) registers.accumulator=value;
     else Write8Bit(valueAddress.second, value);
-    PPUcycles+=6;
 }
 
 void NES::branch6502(StatusFlags flag, bool set, int8_t value)
 {
     if(((bool)GetProcessorStatusFlag(flag)) == set)
+    {
         registers.programCounter += value;
-    PPUcycles+=6;
+        if(value < 0)
+            CheckIdleLoop(registers.programCounter - value);
+    }
+}
+
+void NES::CheckIdleLoop(uint16_t jumpFrom)
+{
+    if(!options.skipIdleLoops)
+        return;
+
+    uint16_t head = registers.programCounter;
+    if(jumpFrom - head > 32 && !std::count(options.idleLoopHints.begin(), options.idleLoopHints.end(), head))
+    {
+        idleLoop.head = -1;
+        return;
+    }
+
+    uint8_t status = GetProcessorStatus();
+    uint8_t PPUbits = PPUstatus.VBlanking | (PPUstatus.hitSprite0 << 1) | (PPUstatus.spriteOverflow << 2) | (PPUstatus.firstRead << 3);
+    if(idleLoop.head == head && idleLoop.clean && idleLoop.accumulator == registers.accumulator && idleLoop.Xregister == registers.Xregister &&
+       idleLoop.Yregister == registers.Yregister && idleLoop.stackPointer == registers.stackPointer && idleLoop.status == status && idleLoop.PPUbits == PPUbits)
+    {
+        //the last pass through the loop only read RAM, ROM or $2002 and ended in the exact state it started in,
+        //so every pass until the next event will be identical. jump over as many of them as fit before it,
+        //leaving room for the longest possible instruction so nothing lands past the deadline
+        uint64_t length = masterClock - idleLoop.arrivalClock;
+        uint64_t deadline = scheduler.NextDeadline();
+        if(length > 0 && masterClock + length + 21 < deadline)
+        {
+            uint64_t skipped = (deadline - 1 - 21 - masterClock) / length * length;
+            masterClock += skipped;
+            idleCyclesSkipped += skipped;
+        }
+    }
+
+    idleLoop.head = head;
+    idleLoop.arrivalClock = masterClock;
+    idleLoop.clean = true;
+    idleLoop.accumulator = registers.accumulator;
+    idleLoop.Xregister = registers.Xregister;
+    idleLoop.Yregister = registers.Yregister;
+    idleLoop.stackPointer = registers.stackPointer;
+    idleLoop.status = status;
+    idleLoop.PPUbits = PPUbits;
 }
 
 void NES::jsr6502()
 {
     PushStack16Bit(registers.programCounter+1);
     registers.programCounter = Read16Bit(registers.programCounter, false);
-    PPUcycles+=18;
 }
 
 void NES::rti6502()
 {
-    registers.processorStatus = PullStack8Bit() & 0b11001111;
+    SetProcessorStatus(PullStack8Bit() & 0b11001111);
     registers.programCounter = PullStack16Bit();
-    PPUcycles += 18;
 }
 
 void NES::add6502(uint8_t value)
 {
-    uint16_t result = value + registers.accumulator + GetProcessorStatusFlag(CARRY);
-    int16_t signedResult = (int8_t)value + (int8_t)registers.accumulator + GetProcessorStatusFlag(CARRY);
+    uint16_t result = value + registers.accumulator + registers.carry;
+    int16_t signedResult = (int8_t)value + (int8_t)registers.accumulator + registers.carry;
     registers.accumulator=result;
-    SetProcessorStatusFlag(CARRY, result > 255);
-    SetProcessorStatusFlag(OVERFLOW, signedResult > 127 || signedResult < -128);
+    registers.carry = result > 255;
+    registers.overflow = signedResult > 127 || signedResult < -128;
     UpdateZeroAndNegativeFlags(registers.accumulator);
-    PPUcycles+=6;
 }
 
 void NES::subtract6502(uint8_t value)
 {
-    uint8_t notCarry = 1 - GetProcessorStatusFlag(CARRY);
+    uint8_t notCarry = 1 - registers.carry;
     uint16_t result = registers.accumulator - value - notCarry;
     int16_t signedResult = (int8_t)registers.accumulator - (int8_t)value - notCarry;
-    SetProcessorStatusFlag(CARRY, (uint16_t)registers.accumulator >= (uint16_t)value + notCarry);
-    SetProcessorStatusFlag(OVERFLOW, signedResult > 127 || signedResult < -128);
+    registers.carry = (uint16_t)registers.accumulator >= (uint16_t)value + notCarry;
+    registers.overflow = signedResult > 127 || signedResult < -128;
     registers.accumulator = result;
     UpdateZeroAndNegativeFlags(registers.accumulator);
-    PPUcycles += 6;
 }
 
 void NES::store6502(uint16_t address, uint8_t value)
 {
     //std::cout << "attempted to write 0x" << std::hex << (uint32_t)value << " to 0x" << address << "\n";
     Write8Bit(address, value);
-    PPUcycles += 9;
 }
 
 void NES::load6502(uint8_t value, uint8_t& dest)
@@ -350,7 +385,6 @@ void NES::load6502(uint8_t value, uint8_t& dest)
     //std::cout << "loaded 0x" << std::hex << (uint32_t)value << "\n";
     dest=value;
     UpdateZeroAndNegativeFlags(value);
-    PPUcycles += 6;
 }
 
 void NES::inc6502(uint8_t& value, bool dec)
@@ -358,21 +392,18 @@ void NES::inc6502(uint8_t& value, bool dec)
     if(dec) value--;
     else value++;
     UpdateZeroAndNegativeFlags(value);
-    PPUcycles+=9;
 }
 
 void NES::transfer6502(uint8_t source, uint8_t &destination, bool updateFlags)
 {
     destination=source;
     if(updateFlags) UpdateZeroAndNegativeFlags(source);
-    PPUcycles += 6;
 }
 
 void NES::compare6502(uint8_t value, uint8_t value2)
 {
-    SetProcessorStatusFlag(CARRY, value >= value2);
+    registers.carry = value >= value2;
     UpdateZeroAndNegativeFlags(value - value2);
-    PPUcycles+=6;
 }
 
 void NES::incMem6502(std::pair<uint16_t, uint16_t> valueAddress, bool dec)
@@ -382,188 +413,194 @@ void NES::incMem6502(std::pair<uint16_t, uint16_t> valueAddress, bool dec)
     else value++;
     Write8Bit(valueAddress.second, value);
     UpdateZeroAndNegativeFlags(value);
-    PPUcycles+=15;
 }
 
-void printOpcode(uint8_t opcode)
+void printOpcode(uint8_t opcode, ostream& out)
 {
     switch(opcode)
     {
-    case 0x00: cout << "BRK" << '\n'; return;
-    case 0x01: cout << "ORA x ind" << '\n'; return;
-    case 0x05: cout << "ORA zpg" << '\n'; return;
-    case 0x06: cout << "ASL zpg" << '\n'; return;
-    case 0x08: cout << "PHP" << '\n'; return;
-    case 0x09: cout << "ORA #" << '\n'; return;
-    case 0x0A: cout << "ASL A" << '\n'; return;
-    case 0x0D: cout << "ORA abs" << '\n'; return;
-    case 0x0E: cout << "ASL abs" << '\n'; return;
-    case 0x10: cout << "BPL" << '\n'; return;
-    case 0x11: cout << "ORA ind y" << '\n'; return;
-    case 0x15: cout << "ORA zpg x" << '\n'; return;
-    case 0x16: cout << "ASL zpg x" << '\n'; return;
-    case 0x18: cout << "CLC" << '\n'; return;
-    case 0x19: cout << "ORA abs y" << '\n'; return;
-    case 0x1D: cout << "ORA abs x" << '\n'; return;
-    case 0x1E: cout << "ASL abs x" << '\n'; return;
-    case 0x20: cout << "JSR" << '\n'; return;
-    case 0x21: cout << "AND x ind" << '\n'; return;
-    case 0x24: cout << "BIT zpg" << '\n'; return;
-    case 0x25: cout << "AND zpg" << '\n'; return;
-    case 0x26: cout << "ROL zpg" << '\n'; return;
-    case 0x28: cout << "PLP" << '\n'; return;
-    case 0x29: cout << "AND #" << '\n'; return;
-    case 0x2A: cout << "ROL A" << '\n'; return;
-    case 0x2C: cout << "BIT abs" << '\n'; return;
-    case 0x2D: cout << "AND abs" << '\n'; return;
-    case 0x2E: cout << "ROL abs" << '\n'; return;
-    case 0x30: cout << "BMI" << '\n'; return;
-    case 0x31: cout << "AND ind y" << '\n'; return;
-    case 0x35: cout << "AND zpg x" << '\n'; return;
-    case 0x36: cout << "ROL zpg x" << '\n'; return;
-    case 0x38: cout << "SEC" << '\n'; return;
-    case 0x39: cout << "AND abs y" << '\n'; return;
-    case 0x3D: cout << "AND abs x" << '\n'; return;
-    case 0x3E: cout << "ROL abs x" << '\n'; return;
-    case 0x40: cout << "RTI" << '\n'; return;
-    case 0x41: cout << "EOR x ind" << '\n'; return;
-    case 0x45: cout << "EOR zpg" << '\n'; return;
-    case 0x46: cout << "LSR zpg" << '\n'; return;
-    case 0x48: cout << "PHA" << '\n'; return;
-    case 0x49: cout << "EOR #" << '\n'; return;
-    case 0x4A: cout << "LSR A" << '\n'; return;
-    case 0x4C: cout << "JMP abs" << '\n'; return;
-    case 0x4D: cout << "EOR abs" << '\n'; return;
-    case 0x4E: cout << "LSR abs" << '\n'; return;
-    case 0x50: cout << "BVC" << '\n'; return;
-    case 0x51: cout << "EOR ind y" << '\n'; return;
-    case 0x55: cout << "EOR zpg x" << '\n'; return;
-    case 0x56: cout << "LSR zpg x" << '\n'; return;
-    case 0x58: cout << "CLI" << '\n'; return;
-    case 0x59: cout << "EOR abs y" << '\n'; return;
-    case 0x5D: cout << "EOR abs x" << '\n'; return;
-    case 0x5E: cout << "LSR abs X" << '\n'; return;
-    case 0x60: cout << "RTS" << '\n'; return;
-    case 0x61: cout << "ADC x ind" << '\n'; return;
-    case 0x65: cout << "ADC zpg" << '\n'; return;
-    case 0x66: cout << "ROR zpg" << '\n'; return;
-    case 0x68: cout << "PLA" << '\n'; return;
-    case 0x69: cout << "ADC #" << '\n'; return;
-    case 0x6A: cout << "ROR A" << '\n'; return;
-    case 0x6C: cout << "JMP ind" << '\n'; return;
-    case 0x6D: cout << "ADC abs" << '\n'; return;
-    case 0x6E: cout << "ROR abs" << '\n'; return;
-    case 0x70: cout << "BVS" << '\n'; return;
-    case 0x71: cout << "ADC ind y" << '\n'; return;
-    case 0x75: cout << "ADC zpg x" << '\n'; return;
-    case 0x76: cout << "ROR zpg x" << '\n'; return;
-    case 0x78: cout << "SEI" << '\n'; return;
-    case 0x79: cout << "ADC abs y" << '\n'; return;
-    case 0x7D: cout << "ADC abs x" << '\n'; return;
-    case 0x7E: cout << "ROR abs x" << '\n'; return;
-    case 0x81: cout << "STA x ind" << '\n'; return;
-    case 0x84: cout << "STY zpg" << '\n'; return;
-    case 0x85: cout << "STA zpg" << '\n'; return;
-    case 0x86: cout << "STX zpg" << '\n'; return;
-    case 0x88: cout << "DEY" << '\n'; return;
-    case 0x8A: cout << "TXA" << '\n'; return;
-    case 0x8C: cout << "STY abs" << '\n'; return;
-    case 0x8D: cout << "STA abs" << '\n'; return;
-    case 0x8E: cout << "STX abs" << '\n'; return;
-    case 0x90: cout << "BCC" << '\n'; return;
-    case 0x91: cout << "STA ind Y" << '\n'; return;
-    case 0x94: cout << "STY zpg x" << '\n'; return;
-    case 0x95: cout << "STA zpg x" << '\n'; return;
-    case 0x96: cout << "STX zpg y" << '\n'; return;
-    case 0x98: cout << "TYA" << '\n'; return;
-    case 0x99: cout << "STA abs y" << '\n'; return;
-    case 0x9A: cout << "TXS" << '\n'; return;
-    case 0x9D: cout << "STA abs x" << '\n'; return;
-    case 0xA0: cout << "LDY #" << '\n'; return;
-    case 0xA1: cout << "LDA x ind" << '\n'; return;
-    case 0xA2: cout << "LDX #" << '\n'; return;
-    case 0xA4: cout << "LDY zpg" << '\n'; return;
-    case 0xA5: cout << "LDA zpg" << '\n'; return;
-    case 0xA6: cout << "LDX zpg" << '\n'; return;
-    case 0xA8: cout << "TAY" << '\n'; return;
-    case 0xA9: cout << "LDA #" << '\n'; return;
-    case 0xAA: cout << "TAX" << '\n'; return;
-    case 0xAC: cout << "LDY abs" << '\n'; return;
-    case 0xAD: cout << "LDA abs" << '\n'; return;
-    case 0xAE: cout << "LDX abs" << '\n'; return;
-    case 0xB0: cout << "BCS" << '\n'; return;
-    case 0xB1: cout << "LDA ind y" << '\n'; return;
-    case 0xB4: cout << "LDY zpg x" << '\n'; return;
-    case 0xB5: cout << "LDA zpg x" << '\n'; return;
-    case 0xB6: cout << "LDX zpg y" << '\n'; return;
-    case 0xB8: cout << "CLV" << '\n'; return;
-    case 0xB9: cout << "LDA abs y" << '\n'; return;
-    case 0xBA: cout << "TSX" << '\n'; return;
-    case 0xBC: cout << "LDY abs x" << '\n'; return;
-    case 0xBD: cout << "LDA abs x" << '\n'; return;
-    case 0xBE: cout << "LDX abs y" << '\n'; return;
-    case 0xC0: cout << "CPY #" << '\n'; return;
-    case 0xC1: cout << "CMP x ind" << '\n'; return;
-    case 0xC4: cout << "CPY zpg" << '\n'; return;
-    case 0xC5: cout << "CMP zpg" << '\n'; return;
-    case 0xC6: cout << "DEC zpg" << '\n'; return;
-    case 0xC8: cout << "INY" << '\n'; return;
-    case 0xC9: cout << "CMP #" << '\n'; return;
-    case 0xCA: cout << "DEX" << '\n'; return;
-    case 0xCC: cout << "CPY abs" << '\n'; return;
-    case 0xCD: cout << "CMP abs" << '\n'; return;
-    case 0xCE: cout << "DEC abs" << '\n'; return;
-    case 0xD0: cout << "BNE" << '\n'; return;
-    case 0xD1: cout << "CMP ind y" << '\n'; return;
-    case 0xD5: cout << "CMP zpg x" << '\n'; return;
-    case 0xD6: cout << "DEC zpg x" << '\n'; return;
-    case 0xD8: cout << "CLD" << '\n'; return;
-    case 0xD9: cout << "CMP abs y" << '\n'; return;
-    case 0xDD: cout << "CMP abs x" << '\n'; return;
-    case 0xDE: cout << "DEC abs x" << '\n'; return;
-    case 0xE0: cout << "CPX #" << '\n'; return;
-    case 0xE1: cout << "SBC x ind" << '\n'; return;
-    case 0xE4: cout << "CPX zpg" << '\n'; return;
-    case 0xE5: cout << "SBC zpg" << '\n'; return;
-    case 0xE6: cout << "INC zpg" << '\n'; return;
-    case 0xE8: cout << "INX" << '\n'; return;
-    case 0xE9: cout << "SBC #" << '\n'; return;
-    case 0xEA: cout << "NOP" << '\n'; return;
-    case 0xEC: cout << "CPX abs" << '\n'; return;
-    case 0xED: cout << "SBC abs" << '\n'; return;
-    case 0xEE: cout << "INC abs" << '\n'; return;
-    case 0xF0: cout << "BEQ" << '\n'; return;
-    case 0xF1: cout << "SBC ind y" << '\n'; return;
-    case 0xF5: cout << "SBC zpg x" << '\n'; return;
-    case 0xF6: cout << "INC zpg x" << '\n'; return;
-    case 0xF8: cout << "SED" << '\n'; return;
-    case 0xF9: cout << "SBC abs y" << '\n'; return;
-    case 0xFD: cout << "SBC abs x" << '\n'; return;
-    case 0xFE: cout << "INC abs x" << '\n'; return;
+    case 0x00: out << "BRK" << '\n'; return;
+    case 0x01: out << "ORA x ind" << '\n'; return;
+    case 0x05: out << "ORA zpg" << '\n'; return;
+    case 0x06: out << "ASL zpg" << '\n'; return;
+    case 0x08: out << "PHP" << '\n'; return;
+    case 0x09: out << "ORA #" << '\n'; return;
+    case 0x0A: out << "ASL A" << '\n'; return;
+    case 0x0D: out << "ORA abs" << '\n'; return;
+    case 0x0E: out << "ASL abs" << '\n'; return;
+    case 0x10: out << "BPL" << '\n'; return;
+    case 0x11: out << "ORA ind y" << '\n'; return;
+    case 0x15: out << "ORA zpg x" << '\n'; return;
+    case 0x16: out << "ASL zpg x" << '\n'; return;
+    case 0x18: out << "CLC" << '\n'; return;
+    case 0x19: out << "ORA abs y" << '\n'; return;
+    case 0x1D: out << "ORA abs x" << '\n'; return;
+    case 0x1E: out << "ASL abs x" << '\n'; return;
+    case 0x20: out << "JSR" << '\n'; return;
+    case 0x21: out << "AND x ind" << '\n'; return;
+    case 0x24: out << "BIT zpg" << '\n'; return;
+    case 0x25: out << "AND zpg" << '\n'; return;
+    case 0x26: out << "ROL zpg" << '\n'; return;
+    case 0x28: out << "PLP" << '\n'; return;
+    case 0x29: out << "AND #" << '\n'; return;
+    case 0x2A: out << "ROL A" << '\n'; return;
+    case 0x2C: out << "BIT abs" << '\n'; return;
+    case 0x2D: out << "AND abs" << '\n'; return;
+    case 0x2E: out << "ROL abs" << '\n'; return;
+    case 0x30: out << "BMI" << '\n'; return;
+    case 0x31: out << "AND ind y" << '\n'; return;
+    case 0x35: out << "AND zpg x" << '\n'; return;
+    case 0x36: out << "ROL zpg x" << '\n'; return;
+    case 0x38: out << "SEC" << '\n'; return;
+    case 0x39: out << "AND abs y" << '\n'; return;
+    case 0x3D: out << "AND abs x" << '\n'; return;
+    case 0x3E: out << "ROL abs x" << '\n'; return;
+    case 0x40: out << "RTI" << '\n'; return;
+    case 0x41: out << "EOR x ind" << '\n'; return;
+    case 0x45: out << "EOR zpg" << '\n'; return;
+    case 0x46: out << "LSR zpg" << '\n'; return;
+    case 0x48: out << "PHA" << '\n'; return;
+    case 0x49: out << "EOR #" << '\n'; return;
+    case 0x4A: out << "LSR A" << '\n'; return;
+    case 0x4C: out << "JMP abs" << '\n'; return;
+    case 0x4D: out << "EOR abs" << '\n'; return;
+    case 0x4E: out << "LSR abs" << '\n'; return;
+    case 0x50: out << "BVC" << '\n'; return;
+    case 0x51: out << "EOR ind y" << '\n'; return;
+    case 0x55: out << "EOR zpg x" << '\n'; return;
+    case 0x56: out << "LSR zpg x" << '\n'; return;
+    case 0x58: out << "CLI" << '\n'; return;
+    case 0x59: out << "EOR abs y" << '\n'; return;
+    case 0x5D: out << "EOR abs x" << '\n'; return;
+    case 0x5E: out << "LSR abs X" << '\n'; return;
+    case 0x60: out << "RTS" << '\n'; return;
+    case 0x61: out << "ADC x ind" << '\n'; return;
+    case 0x65: out << "ADC zpg" << '\n'; return;
+    case 0x66: out << "ROR zpg" << '\n'; return;
+    case 0x68: out << "PLA" << '\n'; return;
+    case 0x69: out << "ADC #" << '\n'; return;
+    case 0x6A: out << "ROR A" << '\n'; return;
+    case 0x6C: out << "JMP ind" << '\n'; return;
+    case 0x6D: out << "ADC abs" << '\n'; return;
+    case 0x6E: out << "ROR abs" << '\n'; return;
+    case 0x70: out << "BVS" << '\n'; return;
+    case 0x71: out << "ADC ind y" << '\n'; return;
+    case 0x75: out << "ADC zpg x" << '\n'; return;
+    case 0x76: out << "ROR zpg x" << '\n'; return;
+    case 0x78: out << "SEI" << '\n'; return;
+    case 0x79: out << "ADC abs y" << '\n'; return;
+    case 0x7D: out << "ADC abs x" << '\n'; return;
+    case 0x7E: out << "ROR abs x" << '\n'; return;
+    case 0x81: out << "STA x ind" << '\n'; return;
+    case 0x84: out << "STY zpg" << '\n'; return;
+    case 0x85: out << "STA zpg" << '\n'; return;
+    case 0x86: out << "STX zpg" << '\n'; return;
+    case 0x88: out << "DEY" << '\n'; return;
+    case 0x8A: out << "TXA" << '\n'; return;
+    case 0x8C: out << "STY abs" << '\n'; return;
+    case 0x8D: out << "STA abs" << '\n'; return;
+    case 0x8E: out << "STX abs" << '\n'; return;
+    case 0x90: out << "BCC" << '\n'; return;
+    case 0x91: out << "STA ind Y" << '\n'; return;
+    case 0x94: out << "STY zpg x" << '\n'; return;
+    case 0x95: out << "STA zpg x" << '\n'; return;
+    case 0x96: out << "STX zpg y" << '\n'; return;
+    case 0x98: out << "TYA" << '\n'; return;
+    case 0x99: out << "STA abs y" << '\n'; return;
+    case 0x9A: out << "TXS" << '\n'; return;
+    case 0x9D: out << "STA abs x" << '\n'; return;
+    case 0xA0: out << "LDY #" << '\n'; return;
+    case 0xA1: out << "LDA x ind" << '\n'; return;
+    case 0xA2: out << "LDX #" << '\n'; return;
+    case 0xA4: out << "LDY zpg" << '\n'; return;
+    case 0xA5: out << "LDA zpg" << '\n'; return;
+    case 0xA6: out << "LDX zpg" << '\n'; return;
+    case 0xA8: out << "TAY" << '\n'; return;
+    case 0xA9: out << "LDA #" << '\n'; return;
+    case 0xAA: out << "TAX" << '\n'; return;
+    case 0xAC: out << "LDY abs" << '\n'; return;
+    case 0xAD: out << "LDA abs" << '\n'; return;
+    case 0xAE: out << "LDX abs" << '\n'; return;
+    case 0xB0: out << "BCS" << '\n'; return;
+    case 0xB1: out << "LDA ind y" << '\n'; return;
+    case 0xB4: out << "LDY zpg x" << '\n'; return;
+    case 0xB5: out << "LDA zpg x" << '\n'; return;
+    case 0xB6: out << "LDX zpg y" << '\n'; return;
+    case 0xB8: out << "CLV" << '\n'; return;
+    case 0xB9: out << "LDA abs y" << '\n'; return;
+    case 0xBA: out << "TSX" << '\n'; return;
+    case 0xBC: out << "LDY abs x" << '\n'; return;
+    case 0xBD: out << "LDA abs x" << '\n'; return;
+    case 0xBE: out << "LDX abs y" << '\n'; return;
+    case 0xC0: out << "CPY #" << '\n'; return;
+    case 0xC1: out << "CMP x ind" << '\n'; return;
+    case 0xC4: out << "CPY zpg" << '\n'; return;
+    case 0xC5: out << "CMP zpg" << '\n'; return;
+    case 0xC6: out << "DEC zpg" << '\n'; return;
+    case 0xC8: out << "INY" << '\n'; return;
+    case 0xC9: out << "CMP #" << '\n'; return;
+    case 0xCA: out << "DEX" << '\n'; return;
+    case 0xCC: out << "CPY abs" << '\n'; return;
+    case 0xCD: out << "CMP abs" << '\n'; return;
+    case 0xCE: out << "DEC abs" << '\n'; return;
+    case 0xD0: out << "BNE" << '\n'; return;
+    case 0xD1: out << "CMP ind y" << '\n'; return;
+    case 0xD5: out << "CMP zpg x" << '\n'; return;
+    case 0xD6: out << "DEC zpg x" << '\n'; return;
+    case 0xD8: out << "CLD" << '\n'; return;
+    case 0xD9: out << "CMP abs y" << '\n'; return;
+    case 0xDD: out << "CMP abs x" << '\n'; return;
+    case 0xDE: out << "DEC abs x" << '\n'; return;
+    case 0xE0: out << "CPX #" << '\n'; return;
+    case 0xE1: out << "SBC x ind" << '\n'; return;
+    case 0xE4: out << "CPX zpg" << '\n'; return;
+    case 0xE5: out << "SBC zpg" << '\n'; return;
+    case 0xE6: out << "INC zpg" << '\n'; return;
+    case 0xE8: out << "INX" << '\n'; return;
+    case 0xE9: out << "SBC #" << '\n'; return;
+    case 0xEA: out << "NOP" << '\n'; return;
+    case 0xEC: out << "CPX abs" << '\n'; return;
+    case 0xED: out << "SBC abs" << '\n'; return;
+    case 0xEE: out << "INC abs" << '\n'; return;
+    case 0xF0: out << "BEQ" << '\n'; return;
+    case 0xF1: out << "SBC ind y" << '\n'; return;
+    case 0xF5: out << "SBC zpg x" << '\n'; return;
+    case 0xF6: out << "INC zpg x" << '\n'; return;
+    case 0xF8: out << "SED" << '\n'; return;
+    case 0xF9: out << "SBC abs y" << '\n'; return;
+    case 0xFD: out << "SBC abs x" << '\n'; return;
+    case 0xFE: out << "INC abs x" << '\n'; return;
     default:
         cerr << "invalid opcode " << std::setfill('0') << std::setw(2) << std::hex << ((int)opcode & 0xFF) << "\n";
     }
 }
 
+void NES::ExecuteInstruction()
+{
+    uint8_t opcode = Read8Bit(registers.programCounter, true);
+    ExecuteStep(opcode);
+    masterClock += opcodeCycles[opcode] * 3;
+}
+
 void NES::ExecuteStep(uint8_t opcode)
 {
-    //printOpcode(opcode);
+    //printOpcode(opcode, cout);
     switch(opcode)
     {
     case 0x00: return break6502();
     case 0x01: return or6502(GetOperandAddressValue(INDIRECT_X_INDEX).first);
     case 0x05: return or6502(GetOperandAddressValue(ZEROPAGE).first);
     case 0x06: return shift6502(true, false, false, GetOperandAddressValue(ZEROPAGE));
-    case 0x08: PPUcycles+=9; return PushStack8Bit(registers.processorStatus | 0b00110000);
+    case 0x08: return PushStack8Bit(GetProcessorStatus() | 0b00110000);
     case 0x09: return or6502(GetOperandAddressValue(IMMEDIATE).first);
     case 0x0A: return shift6502(true, false, true, GetOperandAddressValue(ACCUMULATOR));
     case 0x0D: return or6502(GetOperandAddressValue(ABSOLUTE).first);
     case 0x0E: return shift6502(true, false, false, GetOperandAddressValue(ABSOLUTE));
-    case 0x10: return branch6502(NEGATIVE, false, Read8Bit(registers.programCounter, true));
+    case 0x10: return branch6502(NEGATIVE, false, FetchOperand8());
     case 0x11: return or6502(GetOperandAddressValue(INDIRECT_Y_INDEX).first);
     case 0x15: return or6502(GetOperandAddressValue(ZEROPAGE_X_INDEX).first);
     case 0x16: return shift6502(true, false, false, GetOperandAddressValue(ZEROPAGE_X_INDEX));
-    case 0x18: PPUcycles+=6; return SetProcessorStatusFlag(CARRY, false); 
+    case 0x18: return SetProcessorStatusFlag(CARRY, false); 
     case 0x19: return or6502(GetOperandAddressValue(ABSOLUTE_Y_INDEX).first);
     case 0x1D: return or6502(GetOperandAddressValue(ABSOLUTE_X_INDEX).first);
     case 0x1E: return shift6502(true, false, false, GetOperandAddressValue(ABSOLUTE_X_INDEX));
@@ -572,17 +609,17 @@ void NES::ExecuteStep(uint8_t opcode)
     case 0x24: return bit6502(GetOperandAddressValue(ZEROPAGE).first);
     case 0x25: return and6502(GetOperandAddressValue(ZEROPAGE).first);
     case 0x26: return shift6502(true, true, false, GetOperandAddressValue(ZEROPAGE));
-    case 0x28: PPUcycles+=12; registers.processorStatus = PullStack8Bit() & 0b11001111; return;
+    case 0x28: SetProcessorStatus(PullStack8Bit() & 0b11001111); return;
     case 0x29: return and6502(GetOperandAddressValue(IMMEDIATE).first);
     case 0x2A: return shift6502(true, true, true, GetOperandAddressValue(ACCUMULATOR));
     case 0x2C: return bit6502(GetOperandAddressValue(ABSOLUTE).first);
     case 0x2D: return and6502(GetOperandAddressValue(ABSOLUTE).first);
     case 0x2E: return shift6502(true, true, false, GetOperandAddressValue(ABSOLUTE));
-    case 0x30: return branch6502(NEGATIVE, true, Read8Bit(registers.programCounter, true));
+    case 0x30: return branch6502(NEGATIVE, true, FetchOperand8());
     case 0x31: return and6502(GetOperandAddressValue(INDIRECT_Y_INDEX).first);
     case 0x35: return and6502(GetOperandAddressValue(ZEROPAGE_X_INDEX).first);
     case 0x36: return shift6502(true, true, false, GetOperandAddressValue(ZEROPAGE_X_INDEX));
-    case 0x38: PPUcycles+=6; return SetProcessorStatusFlag(CARRY, true); 
+    case 0x38: return SetProcessorStatusFlag(CARRY, true); 
     case 0x39: return and6502(GetOperandAddressValue(ABSOLUTE_Y_INDEX).first);
     case 0x3D: return and6502(GetOperandAddressValue(ABSOLUTE_X_INDEX).first);
     case 0x3E: return shift6502(true, true, false, GetOperandAddressValue(ABSOLUTE_X_INDEX));
@@ -590,27 +627,30 @@ void NES::ExecuteStep(uint8_t opcode)
     case 0x41: return eor6502(GetOperandAddressValue(INDIRECT_X_INDEX).first);
     case 0x45: return eor6502(GetOperandAddressValue(ZEROPAGE).first);
     case 0x46: return shift6502(false, false, false, GetOperandAddressValue(ZEROPAGE));
-    case 0x48: PPUcycles+=9; return PushStack8Bit(registers.accumulator); 
+    case 0x48: return PushStack8Bit(registers.accumulator); 
     case 0x49: return eor6502(GetOperandAddressValue(IMMEDIATE).first);
     case 0x4A: return shift6502(false, false, true, GetOperandAddressValue(ACCUMULATOR));
     case 0x4C: 
-        PPUcycles+=9; 
+    {
         //cout << "PC: " << std::setfill('0') << std::setw(4) << std::hex << registers.programCounter << " -> ";
+        uint16_t jumpFrom = registers.programCounter - 1;
         registers.programCounter = GetOperandAddress(ABSOLUTE);
+        if(registers.programCounter <= jumpFrom)
+            CheckIdleLoop(jumpFrom);
         //cout << std::setfill('0') << std::setw(4) << std::hex << registers.programCounter << "\n";
         return; 
+    }
     case 0x4D: return eor6502(GetOperandAddressValue(ABSOLUTE).first);
     case 0x4E: return shift6502(false, false, false, GetOperandAddressValue(ABSOLUTE));
-    case 0x50: return branch6502(OVERFLOW, false, Read8Bit(registers.programCounter, true));
+    case 0x50: return branch6502(OVERFLOW, false, FetchOperand8());
     case 0x51: return eor6502(GetOperandAddressValue(INDIRECT_Y_INDEX).first);
     case 0x55: return eor6502(GetOperandAddressValue(ZEROPAGE_X_INDEX).first);
     case 0x56: return shift6502(false, false, false, GetOperandAddressValue(ZEROPAGE_X_INDEX));
-    case 0x58: PPUcycles+=6; return SetProcessorStatusFlag(INTERRUPT_DISABLE, false);  
+    case 0x58: return SetProcessorStatusFlag(INTERRUPT_DISABLE, false);  
     case 0x59: return eor6502(GetOperandAddressValue(ABSOLUTE_Y_INDEX).first);
     case 0x5D: return eor6502(GetOperandAddressValue(ABSOLUTE_X_INDEX).first);
     case 0x5E: return shift6502(false, false, false, GetOperandAddressValue(ABSOLUTE_X_INDEX));
     case 0x60: 
-        PPUcycles+=18;
         //cout << "PC: " << std::setfill('0') << std::setw(4) << std::hex << registers.programCounter << " -> ";
         registers.programCounter = PullStack16Bit()+1;
         //cout << std::setfill('0') << std::setw(4) << std::hex << registers.programCounter << "\n";
@@ -618,17 +658,17 @@ void NES::ExecuteStep(uint8_t opcode)
     case 0x61: return add6502(GetOperandAddressValue(INDIRECT_X_INDEX).first);
     case 0x65: return add6502(GetOperandAddressValue(ZEROPAGE).first);
     case 0x66: return shift6502(false, true, false, GetOperandAddressValue(ZEROPAGE));
-    case 0x68: PPUcycles+=12; registers.accumulator = PullStack8Bit(); UpdateZeroAndNegativeFlags(registers.accumulator); return; 
+    case 0x68: registers.accumulator = PullStack8Bit(); UpdateZeroAndNegativeFlags(registers.accumulator); return; 
     case 0x69: return add6502(GetOperandAddressValue(IMMEDIATE).first);
     case 0x6A: return shift6502(false, true, true, GetOperandAddressValue(ACCUMULATOR));
-    case 0x6C: PPUcycles+=9; registers.programCounter = GetOperandAddressValue(INDIRECT).first; return;  
+    case 0x6C: registers.programCounter = GetOperandAddressValue(INDIRECT).first; return;  
     case 0x6D: return add6502(GetOperandAddressValue(ABSOLUTE).first);
     case 0x6E: return shift6502(false, true, false, GetOperandAddressValue(ABSOLUTE));
-    case 0x70: return branch6502(OVERFLOW, true, Read8Bit(registers.programCounter, true));
+    case 0x70: return branch6502(OVERFLOW, true, FetchOperand8());
     case 0x71: return add6502(GetOperandAddressValue(INDIRECT_Y_INDEX).first);
     case 0x75: return add6502(GetOperandAddressValue(ZEROPAGE_X_INDEX).first);
     case 0x76: return shift6502(false, true, false, GetOperandAddressValue(ZEROPAGE_X_INDEX));
-    case 0x78: PPUcycles+=6; return SetProcessorStatusFlag(INTERRUPT_DISABLE, true);   
+    case 0x78: return SetProcessorStatusFlag(INTERRUPT_DISABLE, true);   
     case 0x79: return add6502(GetOperandAddressValue(ABSOLUTE_Y_INDEX).first);
     case 0x7D: return add6502(GetOperandAddressValue(ABSOLUTE_X_INDEX).first);
     case 0x7E: return shift6502(false, true, false, GetOperandAddressValue(ABSOLUTE_X_INDEX));
@@ -641,7 +681,7 @@ void NES::ExecuteStep(uint8_t opcode)
     case 0x8C: return store6502(GetOperandAddress(ABSOLUTE), registers.Yregister); 
     case 0x8D: return store6502(GetOperandAddress(ABSOLUTE), registers.accumulator); 
     case 0x8E: return store6502(GetOperandAddress(ABSOLUTE), registers.Xregister); 
-    case 0x90: return branch6502(CARRY, false, Read8Bit(registers.programCounter, true));
+    case 0x90: return branch6502(CARRY, false, FetchOperand8());
     case 0x91: return store6502(GetOperandAddress(INDIRECT_Y_INDEX), registers.accumulator);  
     case 0x94: return store6502(GetOperandAddress(ZEROPAGE_X_INDEX), registers.Yregister); 
     case 0x95: return store6502(GetOperandAddress(ZEROPAGE_X_INDEX), registers.accumulator);
@@ -662,12 +702,12 @@ void NES::ExecuteStep(uint8_t opcode)
     case 0xAC: return load6502(GetOperandAddressValue(ABSOLUTE).first, registers.Yregister);
     case 0xAD: return load6502(GetOperandAddressValue(ABSOLUTE).first, registers.accumulator);
     case 0xAE: return load6502(GetOperandAddressValue(ABSOLUTE).first, registers.Xregister);
-    case 0xB0: return branch6502(CARRY, true, Read8Bit(registers.programCounter, true));
+    case 0xB0: return branch6502(CARRY, true, FetchOperand8());
     case 0xB1: return load6502(GetOperandAddressValue(INDIRECT_Y_INDEX).first, registers.accumulator);
     case 0xB4: return load6502(GetOperandAddressValue(ZEROPAGE_X_INDEX).first, registers.Yregister);
     case 0xB5: return load6502(GetOperandAddressValue(ZEROPAGE_X_INDEX).first, registers.accumulator);
     case 0xB6: return load6502(GetOperandAddressValue(ZEROPAGE_Y_INDEX).first, registers.Xregister);
-    case 0xB8: PPUcycles+=6; return SetProcessorStatusFlag(OVERFLOW, false);  
+    case 0xB8: return SetProcessorStatusFlag(OVERFLOW, false);  
     case 0xB9: return load6502(GetOperandAddressValue(ABSOLUTE_Y_INDEX).first, registers.accumulator);
     case 0xBA: return transfer6502(registers.stackPointer, registers.Xregister,true);
     case 0xBC: return load6502(GetOperandAddressValue(ABSOLUTE_X_INDEX).first, registers.Yregister);
@@ -684,11 +724,11 @@ void NES::ExecuteStep(uint8_t opcode)
     case 0xCC: return compare6502(registers.Yregister, GetOperandAddressValue(ABSOLUTE).first);
     case 0xCD: return compare6502(registers.accumulator, GetOperandAddressValue(ABSOLUTE).first);
     case 0xCE: return incMem6502(GetOperandAddressValue(ABSOLUTE), true);
-    case 0xD0: return branch6502(ZERO, false, Read8Bit(registers.programCounter, true));
+    case 0xD0: return branch6502(ZERO, false, FetchOperand8());
     case 0xD1: return compare6502(registers.accumulator, GetOperandAddressValue(INDIRECT_Y_INDEX).first);
     case 0xD5: return compare6502(registers.accumulator, GetOperandAddressValue(ZEROPAGE_X_INDEX).first);
     case 0xD6: return incMem6502(GetOperandAddressValue(ZEROPAGE_X_INDEX), true);
-    case 0xD8: PPUcycles+=6; return SetProcessorStatusFlag(DECIMAL, false);
+    case 0xD8: return SetProcessorStatusFlag(DECIMAL, false);
     case 0xD9: return compare6502(registers.accumulator, GetOperandAddressValue(ABSOLUTE_Y_INDEX).first);
     case 0xDD: return compare6502(registers.accumulator, GetOperandAddressValue(ABSOLUTE_X_INDEX).first);
     case 0xDE: return incMem6502(GetOperandAddressValue(ABSOLUTE_X_INDEX), true);
@@ -699,15 +739,15 @@ void NES::ExecuteStep(uint8_t opcode)
     case 0xE6: return incMem6502(GetOperandAddressValue(ZEROPAGE), false);
     case 0xE8: return inc6502(registers.Xregister, false);
     case 0xE9: return subtract6502(GetOperandAddressValue(IMMEDIATE).first);
-    case 0xEA: PPUcycles+=6; return; 
+    case 0xEA: return; 
     case 0xEC: return compare6502(registers.Xregister, GetOperandAddressValue(ABSOLUTE).first);
     case 0xED: return subtract6502(GetOperandAddressValue(ABSOLUTE).first);
     case 0xEE: return incMem6502(GetOperandAddressValue(ABSOLUTE), false);
-    case 0xF0: return branch6502(ZERO, true, Read8Bit(registers.programCounter, true));
+    case 0xF0: return branch6502(ZERO, true, FetchOperand8());
     case 0xF1: return subtract6502(GetOperandAddressValue(INDIRECT_Y_INDEX).first);
     case 0xF5: return subtract6502(GetOperandAddressValue(ZEROPAGE_X_INDEX).first);
     case 0xF6: return incMem6502(GetOperandAddressValue(ZEROPAGE_X_INDEX), false);
-    case 0xF8: PPUcycles+=6; return SetProcessorStatusFlag(DECIMAL, true); 
+    case 0xF8: return SetProcessorStatusFlag(DECIMAL, true); 
     case 0xF9: return subtract6502(GetOperandAddressValue(ABSOLUTE_Y_INDEX).first);
     case 0xFD: return subtract6502(GetOperandAddressValue(ABSOLUTE_X_INDEX).first);
     case 0xFE: return incMem6502(GetOperandAddressValue(ABSOLUTE_X_INDEX), false);
@@ -724,7 +764,7 @@ void NES::DebugPrint()
     cout << "A: " << std::setfill('0') << std::setw(2) << std::hex << (int)registers.accumulator << "\n";
     cout << "X: " << std::setfill('0') << std::setw(2) << std::hex << (int)registers.Xregister << "\n";
     cout << "Y: " << std::setfill('0') << std::setw(2) << std::hex << (int)registers.Yregister << "\n";
-    cout << "PS: " << std::setfill('0') << std::setw(2) << std::hex << (int)registers.processorStatus << "\n\n";
+    cout << "PS: " << std::setfill('0') << std::setw(2) << std::hex << (int)GetProcessorStatus() << "\n\n";
     cout << "PPU\n";
     cout << "nametable: " << (int)PPUstatus.currentNameTable << "\n";
     cout << "inc by 32: " << (PPUstatus.incrementBy32 ? "true" : "false") << "\n";
@@ -765,24 +805,402 @@ void NES::DebugShowMemory(string page)
     }
 }
 
-void NES::Run()
+bool NES::StepInstruction()
+{
+    lastRenderedLine = -1;
+    ExecuteBlock(1);
+    if(masterClock >= scheduler.NextDeadline())
+        return DispatchEvents();
+    return false;
+}
+
+void NES::RunFrame()
+{
+    while(true)
+    {
+        while(masterClock < scheduler.NextDeadline())
+            ExecuteBlock();
+        if(DispatchEvents())
+            return;
+    }
+}
+
+bool NES::DispatchEvents()
+{
+    return header.isPAL ? DispatchEvents<PAL>() : DispatchEvents<NTSC>();
+}
+
+template<typename Region>
+bool NES::DispatchEvents()
+{
+    bool frameDone = false;
+    while(masterClock >= scheduler.NextDeadline())
+    {
+        uint64_t time = scheduler.NextDeadline();
+        switch(scheduler.NextEvent())
+        {
+        case EVENT_SCANLINE_END:
+            scheduler.Schedule(EVENT_SCANLINE_END, time + PPUcyclesPerLine);
+            frameDone |= EndScanline<Region>(time);
+        break;
+        case EVENT_DMC_FETCH:
+            CatchUpDMC<Region>();
+        break;
+        case EVENT_APU_FRAME_STEP:
+        {
+            ScheduleAPUFrameStep<Region>(time);
+            auto start = chrono::high_resolution_clock::now();
+            UpdateAudio<Region>();
+            auto end = chrono::high_resolution_clock::now();
+            frontend->Audiotime += chrono::duration<double, milli>(end - start).count();
+        }
+        break;
+        case EVENT_NMI:
+            scheduler.Cancel(EVENT_NMI);
+            PPUstatus.VBlanking = true;
+            if (PPUstatus.doNMI)
+            {
+                PushStack16Bit(registers.programCounter);
+                PushStack8Bit(GetProcessorStatus());
+                registers.programCounter = Read16Bit(0xFFFA, false);
+            }
+        break;
+        default:
+            scheduler.Cancel(scheduler.NextEvent());
+        }
+    }
+    return frameDone;
+}
+
+template<typename Region>
+bool NES::EndScanline(uint64_t time)
+{
+    if(overclockLinesLeft > 0)
+    {
+        overclockLinesLeft--;
+        return false;
+    }
+
+    //lines above the picture aren't drawn, but sprite 0 can still be hit there
+    if(scanline < Region::firstVisibleLine)
+        PPUCheckSprite0<Region>();
+    else if(scanline < Region::firstVBlankLine)
+    {
+        auto start = chrono::high_resolution_clock::now();
+        PPURenderLine<Region>();
+        lastRenderedLine = scanline;
+        auto end = chrono::high_resolution_clock::now();
+        frontend->PPUtime+= chrono::duration<double, milli>(end - start).count();
+    }
+    
+    scanline++;
+
+    if (scanline == Region::firstVBlankLine)
+        scheduler.Schedule(EVENT_NMI, time);
+    else if (scanline == Region::firstVBlankLine + 1 && options.overclockLines > 0)
+        StartOverclockLines<Region>();
+    else if (scanline >= Region::numTotalLines)
+    {
+        scanline = 0;
+        PPUstatus.VBlanking = false;
+        PPUstatus.hitSprite0 = false;
+        PPUstatus.spriteOverflow = false;
+        lastFrameLagged = !inputPolled;
+        inputPolled = false;
+        frameCount++;
+        lagFrameCount += lastFrameLagged;
+
+        //a skipped frame left the buffers alone, the last completed observation is still the newest
+        if(!skipFrameRendering)
+            observationFrame ^= 1;
+        lastFrameDrawn = !skipFrameRendering;
+        //a skipped frame shows the picture before it, which in a window is no longer in the back buffer
+        if(frontend->capture.Running())
+        {
+            const uint16_t* picture = frontend->presenter.Running() ? frontend->presenter.BackIndices() : GetFrameIndices();
+            frontend->capture.EndFrame(lastFrameDrawn ? picture : nullptr);
+        }
+        //a frame following a lag frame shows what it did, as long as the game left the PPU and the CHR banks alone during
+        //it. many still move sprites or the scroll from NMI while the main loop lags
+        bool pictureKept = !PPUwritten && mapper->CHRBankGeneration == lastCHRBankGeneration;
+        skipFrameRendering = lastFrameLagged && pictureKept && (options.skipLagFrameRendering || frontend->turbo);
+        PPUwritten = false;
+        lastCHRBankGeneration = mapper->CHRBankGeneration;
+        if(!cheats.empty())
+            ApplyRAMCheats();
+
+        //nothing drains the audio queue without a device, and in turbo it fills faster than the device plays it
+        if((options.headless && !options.collectAudio) || frontend->turbo)
+        {
+            lock_guard<mutex> lock(frontend->audioMutex);
+            frontend->audioDataQueue = {};
+            frontend->audioReadOffset = 0;
+        }
+        return true;
+    }
+    return false;
+}
+
+//the next lines only run the CPU. the PPU stays on this line and the APU's clock stands still, so its events move back
+//by the inserted time and audio keeps its pitch
+template<typename Region>
+void NES::StartOverclockLines()
+{
+    CatchUpDMC<Region>();
+    uint64_t delay = options.overclockLines * PPUcyclesPerLine;
+    overclockLinesLeft = options.overclockLines;
+    DMClastClock += delay;
+    for(SchedulerEvent event : {EVENT_APU_FRAME_STEP, EVENT_DMC_FETCH})
+    {
+        if(scheduler.Deadline(event) != Scheduler::NEVER)
+            scheduler.Schedule(event, scheduler.Deadline(event) + delay);
+    }
+}
+
+template<typename Region>
+void NES::ScheduleAPUFrameStep(uint64_t lineEndTime)
+{
+    //the sequencer steps every 65.5 (NTSC) or 78 (PAL) scanlines, always on a scanline boundary
+    int lines = (Region::APUframeStepHalfLines - APUscanlineTiming + 1) / 2;
+    APUscanlineTiming += lines * 2 - Region::APUframeStepHalfLines;
+    scheduler.Schedule(EVENT_APU_FRAME_STEP, lineEndTime + lines * PPUcyclesPerLine);
+}
+
+void NES::PresentFrame()
+{
+    auto start = chrono::high_resolution_clock::now();
+    //the back buffer of a skipped frame still holds an older picture than the one on screen
+    if(lastFrameDrawn)
+        frontend->presenter.Publish(frameCount);
+    auto end = chrono::high_resolution_clock::now();
+    frontend->SDLtime += chrono::duration<double, milli>(end - start).count();
+
+    /*
+    DebugRenderAllNametables();
+    SDL_UpdateTexture(debugnesTexture, NULL, debugnesPixels.get(), 512*sizeof(uint32_t));
+    SDL_RenderCopy(debugRenderer, debugnesTexture, NULL, &frontend->stretchRect);
+    SDL_RenderPresent(debugRenderer);
+    
+   
+    for(int i=0; i<4; i++)
+    {
+        for(int j=0; j<240; j++)
+        {
+            for(int k=0; k<256; k++)
+            {
+                debugHighlightPixel[i][j][k] = false;
+            }
+        }
+    }
+    */
+}
+
+bool NES::PollEvents()
 {
     bool running=true;
     SDL_Event ev;
-    double CPUtime = 0;
-    double PPUtime = 0;
-    double Audiotime = 0;
-    double SDLtime = 0;
+    lock_guard<mutex> lock(frontend->inputMutex);
+    ControllerData& player1 = frontend->keyboard[0];
+    ControllerData& player2 = frontend->keyboard[1];
+    while (SDL_PollEvent(&ev) != 0)
+    {
+        switch (ev.type)
+        {
+        case SDL_QUIT:
+            running = false;
+            break;
+        case SDL_KEYDOWN:
+        case SDL_KEYUP:
+            switch(ev.key.keysym.sym)
+            {
+            case SDLK_w:
+                player1.up=ev.type == SDL_KEYDOWN;
+            break;
+            case SDLK_s:
+                player1.down = ev.type == SDL_KEYDOWN;
+                break;
+            case SDLK_a:
+                player1.left = ev.type == SDL_KEYDOWN;
+                break;
+            case SDLK_d:
+                player1.right = ev.type == SDL_KEYDOWN;
+                break;
+            case SDLK_j:
+                player1.A = ev.type == SDL_KEYDOWN;
+                break;
+            case SDLK_k:
+                player1.B = ev.type == SDL_KEYDOWN;
+                break;
+            case SDLK_LSHIFT:
+                player1.select = ev.type == SDL_KEYDOWN;
+                break;
+            case SDLK_ESCAPE:
+                player1.start = ev.type == SDL_KEYDOWN;
+                break;
+            case SDLK_UP:
+                player2.up=ev.type==SDL_KEYDOWN;
+            break;
+            case SDLK_DOWN:
+                player2.down = ev.type == SDL_KEYDOWN;
+            break;
+            case SDLK_LEFT:
+                player2.left = ev.type == SDL_KEYDOWN;
+            break;
+            case SDLK_RIGHT:
+                player2.right = ev.type == SDL_KEYDOWN;
+            break;
+            case SDLK_COMMA:
+                player2.B = ev.type == SDL_KEYDOWN;
+            break;
+            case SDLK_PERIOD:
+                player2.A = ev.type == SDL_KEYDOWN;
+            break;
+            case SDLK_RETURN:
+                player2.start = ev.type == SDL_KEYDOWN;
+            break;
+            case SDLK_RSHIFT:
+                player2.select = ev.type == SDL_KEYDOWN;
+            break;
+            case SDLK_TAB:
+                frontend->keyboardTurbo = ev.type == SDL_KEYDOWN;
+            break;
+            default:
+                if(ev.type == SDL_KEYDOWN && !ev.key.repeat)
+                    frontend->searchKeys.push_back(ev.key.keysym.sym);
+            }
+        break;
+        }
+    }
+    return running;
+}
+
+void NES::TakeInput()
+{
+    vector<SDL_Keycode> keys;
+    {
+        lock_guard<mutex> lock(frontend->inputMutex);
+        currentStatePlayer1 = frontend->keyboard[0];
+        currentStatePlayer2 = frontend->keyboard[1];
+        frontend->turbo = frontend->keyboardTurbo;
+        keys.swap(frontend->searchKeys);
+    }
+    //the search reads RAM, so it runs here between frames
+    for(SDL_Keycode key : keys)
+        HandleSearchKey(key);
+}
+
+void NES::HandleSearchKey(SDL_Keycode key)
+{
+    RAMSearch& search = frontend->ramSearch;
+    switch(key)
+    {
+    case SDLK_F1:
+        search.Start(*this);
+    break;
+    case SDLK_F2:
+        search.Filter(*this, SEARCH_NOT_EQUAL);
+    break;
+    case SDLK_F3:
+        search.Filter(*this, SEARCH_EQUAL);
+    break;
+    case SDLK_F4:
+        search.Filter(*this, SEARCH_GREATER);
+    break;
+    case SDLK_F5:
+        search.Filter(*this, SEARCH_LESS);
+    break;
+    case SDLK_F6:
+        for(auto [address, value] : search.Candidates(32))
+            cout << "$" << hex << setfill('0') << setw(4) << address << " = " << setw(2) << (int)value << dec << "\n";
+    break;
+    case SDLK_F7:
+        //watching hundreds of addresses would flood the console
+        search.ClearWatches();
+        if(search.Count() <= 16)
+        {
+            for(auto [address, value] : search.Candidates())
+                search.Watch(address, value);
+        }
+    break;
+    default:
+        return;
+    }
+    cout << "RAM search: " << search.Count() << " candidates\n";
+}
+
+void NES::PrintWatchChanges()
+{
+    for(auto [address, oldValue, newValue] : frontend->ramSearch.CheckWatches(*this))
+        cout << "$" << hex << setfill('0') << setw(4) << address << ": " << setw(2) << (int)oldValue << " -> " << setw(2) << (int)newValue << dec << "\n";
+}
+
+void NES::Run()
+{
+    Movie& movie = frontend->movie;
+    if(!options.recordMovie.empty() && !movie.Record(options.recordMovie))
+    {
+        cerr << "Unable to write movie " << options.recordMovie << "\n";
+        exit(8);
+    }
+    if(!options.playMovie.empty() && !movie.Play(options.playMovie))
+    {
+        cerr << "Unable to read movie " << options.playMovie << "\n";
+        exit(8);
+    }
+    uint8_t player1, player2;
+    if(movie.NextFrame(player1, player2))
+    {
+        SetControllerState(0, player1);
+        SetControllerState(1, player2);
+    }
+
+    //SDL's render API is only safe on the main thread, which also pumps the window's events, so the renderer stays
+    //here and the emulation moves to a thread of its own
+    atomic<bool> running{true};
+    thread emulation(&NES::EmulationLoop, this, std::cref(running));
+    frontend->presenter.Run([this]() { return PollEvents(); });
+    running = false;
+    emulation.join();
+
+    mapper->SaveGame();
+    SDL_CloseAudioDevice(frontend->device);
+    frontend->presenter.Stop();
+    SDL_DestroyWindow(frontend->win);
+    frontend->capture.Stop();
+
+    if(options.printStats)
+        cout << "Frames: " << frameCount << ", lag frames: " << lagFrameCount << " (" << fixed << setprecision(1)
+             << (frameCount ? 100.0 * lagFrameCount / frameCount : 0.0) << "%)\n";
+    if(options.printStats && options.overclockLines > 0)
+    {
+        int lines = header.isPAL ? PAL::numTotalLines : NTSC::numTotalLines;
+        cout << "Overclocked by " << options.overclockLines << " lines per frame, " << fixed << setprecision(1)
+             << 100.0 * options.overclockLines / lines << "% more CPU time per frame\n";
+    }
+    if(options.printStats)
+    {
+        frontend->pacer.PrintStats(cout);
+        frontend->presenter.PrintStats(cout);
+        if(!options.capturePath.empty())
+            frontend->capture.PrintStats(cout);
+    }
+}
+
+void NES::EmulationLoop(const atomic<bool>& running)
+{
+    float msPerFrame = header.isPAL ? PAL::msPerFrame : NTSC::msPerFrame;
+    Movie& movie = frontend->movie;
+    uint8_t player1, player2;
     chrono::time_point prevFrame = chrono::high_resolution_clock::now();
     while(running)
     {
 
         //TODO handle IRQ from APU and potentially mapper
         auto start = chrono::high_resolution_clock::now();
-        uint8_t opcode = Read8Bit(registers.programCounter, true);
-        ExecuteStep(opcode);
+        while(masterClock < scheduler.NextDeadline())
+            ExecuteBlock();
         auto end = chrono::high_resolution_clock::now();
-        CPUtime += chrono::duration<double, milli>(end - start).count();
+        frontend->CPUtime += chrono::duration<double, milli>(end - start).count();
         /*
         if(skipInstructions<=0 && !skipFrame && debug)
         {
@@ -811,161 +1229,159 @@ void NES::Run()
         }
         */
         
-        if(PPUcycles > PPUcyclesPerLine)
+        if(DispatchEvents())
         {
-            PPUcycles -= PPUcyclesPerLine;
-            if(scanline < numTotalLines - numVBlankLines)
+            if(movie.IsRecording())
+                movie.AddFrame(GetControllerState(0), GetControllerState(1), lastFrameLagged);
+            //nothing changed on screen, and nobody is watching every frame anyway
+            if(!(frontend->turbo && lastFrameLagged))
+                PresentFrame();
+            TakeInput();
+            PrintWatchChanges();
+            //the movie's buttons replace the keyboard's for the next frame
+            if(movie.NextFrame(player1, player2))
             {
-                start = chrono::high_resolution_clock::now();
-                PPURenderLine();
-                end = chrono::high_resolution_clock::now();
-                PPUtime+= chrono::duration<double, milli>(end - start).count();
+                SetControllerState(0, player1);
+                SetControllerState(1, player2);
             }
-            
-            scanline++;
-            APUscanlineTiming+=2;
-            start = chrono::high_resolution_clock::now();
-            UpdateAudio();
-            end = chrono::high_resolution_clock::now();
-            Audiotime += chrono::duration<double, milli>(end - start).count();
 
-            if (scanline == numTotalLines - numVBlankLines)
+            end = chrono::high_resolution_clock::now();
+            if (chrono::duration<double, milli>(end - prevFrame).count() > msPerFrame)
             {
-                if (PPUstatus.doNMI)
-                {
-                    PushStack16Bit(registers.programCounter);
-                    PushStack8Bit(registers.processorStatus);
-                    registers.programCounter = Read16Bit(0xFFFA, false);
-                }
-
-                PPUstatus.VBlanking = true;
+                //cout << "Frame: " << chrono::duration<double, milli>(end - prevFrame).count() << "ms\n";
+                //cout << "CPU time: " << frontend->CPUtime << "ms PPU time: " << frontend->PPUtime << "ms Audio time: " << frontend->Audiotime << "ms SDL time: " << frontend->SDLtime << "ms\n";
             }
-            else if (scanline >= numTotalLines)
+            //the audio device is the clock. the next frame starts once it has played the queue down to the target latency
+            if(!frontend->turbo)
             {
-                scanline = header.isPAL ? 0 : 8;
-                PPUstatus.VBlanking = false;
-                PPUstatus.hitSprite0 = false;
-                PPUstatus.spriteOverflow = false;
-
-                start = chrono::high_resolution_clock::now();
-                SDL_UpdateTexture(nesTexture, NULL, nesPixels.get(), 256 * sizeof(uint32_t));
-                SDL_RenderCopy(renderer, nesTexture, NULL, &stretchRect);
-                SDL_RenderPresent(renderer);
+                this_thread::sleep_for(frontend->pacer.Wait(QueuedAudioSamples()));
                 end = chrono::high_resolution_clock::now();
-                SDLtime += chrono::duration<double, milli>(end - start).count();
-
-                /*
-                DebugRenderAllNametables();
-                SDL_UpdateTexture(debugnesTexture, NULL, debugnesPixels.get(), 512*sizeof(uint32_t));
-                SDL_RenderCopy(debugRenderer, debugnesTexture, NULL, &stretchRect);
-                SDL_RenderPresent(debugRenderer);
-                
-               
-                for(int i=0; i<4; i++)
-                {
-                    for(int j=0; j<240; j++)
-                    {
-                        for(int k=0; k<256; k++)
-                        {
-                            debugHighlightPixel[i][j][k] = false;
-                        }
-                    }
-                }
-                */
-                start = chrono::high_resolution_clock::now();
-                while (SDL_PollEvent(&ev) != 0)
-                {
-                    switch (ev.type)
-                    {
-                    case SDL_QUIT:
-                        running = false;
-                        break;
-                    case SDL_KEYDOWN:
-                    case SDL_KEYUP:
-                        switch(ev.key.keysym.sym)
-                        {
-                        case SDLK_w:
-                            currentStatePlayer1.up=ev.type == SDL_KEYDOWN;
-                        break;
-                        case SDLK_s:
-                            currentStatePlayer1.down = ev.type == SDL_KEYDOWN;
-                            break;
-                        case SDLK_a:
-                            currentStatePlayer1.left = ev.type == SDL_KEYDOWN;
-                            break;
-                        case SDLK_d:
-                            currentStatePlayer1.right = ev.type == SDL_KEYDOWN;
-                            break;
-                        case SDLK_j:
-                            currentStatePlayer1.A = ev.type == SDL_KEYDOWN;
-                            break;
-                        case SDLK_k:
-                            currentStatePlayer1.B = ev.type == SDL_KEYDOWN;
-                            break;
-                        case SDLK_LSHIFT:
-                            currentStatePlayer1.select = ev.type == SDL_KEYDOWN;
-                            break;
-                        case SDLK_ESCAPE:
-                            currentStatePlayer1.start = ev.type == SDL_KEYDOWN;
-                            break;
-                        case SDLK_UP:
-                            currentStatePlayer2.up=ev.type==SDL_KEYDOWN;
-                        break;
-                        case SDLK_DOWN:
-                            currentStatePlayer2.down = ev.type == SDL_KEYDOWN;
-                        break;
-                        case SDLK_LEFT:
-                            currentStatePlayer2.left = ev.type == SDL_KEYDOWN;
-                        break;
-                        case SDLK_RIGHT:
-                            currentStatePlayer2.right = ev.type == SDL_KEYDOWN;
-                        break;
-                        case SDLK_COMMA:
-                            currentStatePlayer2.B = ev.type == SDL_KEYDOWN;
-                        break;
-                        case SDLK_PERIOD:
-                            currentStatePlayer2.A = ev.type == SDL_KEYDOWN;
-                        break;
-                        case SDLK_RETURN:
-                            currentStatePlayer2.start = ev.type == SDL_KEYDOWN;
-                        break;
-                        case SDLK_RSHIFT:
-                            currentStatePlayer2.select = ev.type == SDL_KEYDOWN;
-                        break;
-                        }
-                    break;
-                    }
-                    end = chrono::high_resolution_clock::now();
-                    SDLtime += chrono::duration<double, milli>(end - start).count();
-                }
-                end = chrono::high_resolution_clock::now();
-                if (chrono::duration<double, milli>(end - prevFrame).count() > msPerFrame)
-                {
-                    //cout << "Frame: " << chrono::duration<double, milli>(end - prevFrame).count() << "ms\n";
-                    //cout << "CPU time: " << CPUtime << "ms PPU time: " << PPUtime << "ms Audio time: " << Audiotime << "ms SDL time: " << SDLtime << "ms\n";
-                }
-                this_thread::sleep_until(prevFrame + chrono::microseconds(static_cast<int>(msPerFrame * 1000)));
-                prevFrame = chrono::high_resolution_clock::now();
-                CPUtime = 0;
-                PPUtime = 0;
-                Audiotime = 0;
-                SDLtime = 0;
+                frontend->resampleRatio = frontend->pacer.Update(QueuedAudioSamples(), chrono::duration<double, milli>(end - prevFrame).count());
             }
+            else
+                frontend->resampleRatio = 1.0;
+            prevFrame = chrono::high_resolution_clock::now();
+            frontend->CPUtime = 0;
+            frontend->PPUtime = 0;
+            frontend->Audiotime = 0;
+            frontend->SDLtime = 0;
         }
     }
-    mapper->SaveGame();
-    SDL_DestroyWindow(win);
 }
 
 void NES::SDLAudioCallback(Uint8* stream, int len)
 {
-    if(audioDataQueue.empty())
-        return;
+    lock_guard<mutex> lock(frontend->audioMutex);
+    frontend->lastAudioCallback = chrono::steady_clock::now();
+    uint16_t* out = (uint16_t*)stream;
+    size_t wanted = len / sizeof(uint16_t);
+    //the device's buffer doesn't have to match the block size, so blocks can be split across callbacks
+    while(wanted > 0 && !frontend->audioDataQueue.empty())
+    {
+        auto& block = frontend->audioDataQueue.front();
+        size_t count = min(wanted, block.size() - frontend->audioReadOffset);
+        memcpy(out, block.data() + frontend->audioReadOffset, count * sizeof(uint16_t));
+        out += count;
+        wanted -= count;
+        frontend->lastPlayedSample = out[-1];
+        frontend->audioPlaying = true;
+        frontend->audioReadOffset += count;
+        if(frontend->audioReadOffset == block.size())
+        {
+            frontend->audioDataQueue.pop();
+            frontend->audioReadOffset = 0;
+        }
+    }
+    //holding the last level instead of dropping to 0 keeps an underrun from clicking
+    if(wanted > 0)
+    {
+        fill(out, out + wanted, frontend->lastPlayedSample);
+        if(frontend->audioPlaying)
+            frontend->pacer.CountUnderrun();
+    }
+}
 
-    auto frontPtr = audioDataQueue.front().data();
-    memcpy(stream, frontPtr, len);
-    audioDataQueue.pop();
-    
+size_t NES::QueuedAudioSamples()
+{
+    lock_guard<mutex> lock(frontend->audioMutex);
+    size_t queued = frontend->audioDataQueue.size() * 512 - frontend->audioReadOffset + frontend->partialCounter;
+    //the device plays what it took in the last callback until the next one. counting down what's left of it
+    //keeps the level from dropping a whole device buffer at a time
+    if(frontend->device && frontend->audioPlaying)
+    {
+        double played = chrono::duration<double>(chrono::steady_clock::now() - frontend->lastAudioCallback).count() * AudioPacer::sampleRate;
+        if(played < frontend->have.samples)
+            queued += frontend->have.samples - static_cast<size_t>(played);
+    }
+    return queued;
+}
+
+std::vector<uint16_t> NES::TakeAudio()
+{
+    lock_guard<mutex> lock(frontend->audioMutex);
+    std::vector<uint16_t> samples;
+    samples.reserve(frontend->audioDataQueue.size() * 512);
+    while(!frontend->audioDataQueue.empty())
+    {
+        auto& block = frontend->audioDataQueue.front();
+        samples.insert(samples.end(), block.begin(), block.end());
+        frontend->audioDataQueue.pop();
+    }
+    return samples;
+}
+
+unique_ptr<NES> NES::Fork() const
+{
+    unique_ptr<NES> copy(new NES(*this));
+    copy->options.headless = true;
+    copy->writeLog = nullptr;
+    return copy;
+}
+
+void NES::RestoreState(const NES& snapshot)
+{
+    //the window, audio device and settings belong to this instance, not the state
+    unique_ptr<Frontend> ownFrontend = std::move(frontend);
+    NESOptions ownOptions = options;
+    auto ownWriteLog = writeLog;
+
+    *this = snapshot;
+
+    frontend = std::move(ownFrontend);
+    options = ownOptions;
+    writeLog = ownWriteLog;
+}
+
+static uint64_t SplitMix64(uint64_t value)
+{
+    value += 0x9E3779B97F4A7C15ull;
+    value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+    value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+    return value ^ (value >> 31);
+}
+
+uint64_t NES::StateHash()
+{
+    for(int page=0; page<8; page++)
+    {
+        if(!(dirtyRAMPages & (1 << page)))
+            continue;
+        uint64_t hash = page;
+        for(int i=0; i<0x100; i+=8)
+        {
+            uint64_t word;
+            memcpy(&word, RAM + page * 0x100 + i, 8);
+            hash = SplitMix64(hash ^ word);
+        }
+        RAMPageHashes[page] = hash;
+    }
+    dirtyRAMPages = 0;
+
+    uint64_t hash = SplitMix64(registers.programCounter | (uint64_t)registers.accumulator << 16 | (uint64_t)registers.Xregister << 24 |
+                               (uint64_t)registers.Yregister << 32 | (uint64_t)registers.stackPointer << 40 | (uint64_t)GetProcessorStatus() << 48);
+    for(int page=0; page<8; page++)
+        hash = SplitMix64(hash ^ RAMPageHashes[page]);
+    return hash;
 }
 /*
 void NES::DebugRenderAllNametables()
@@ -1,27 +1,179 @@
+#pragma once
 #include <iostream>
 #include <vector>
 #include <string.h>
 #include <SDL2/SDL.h>
 #include <memory>
 #include <mutex>
+#include <atomic>
+#include <chrono>
 #include <queue>
+#include <array>
+#include <random>
 #include "mappers/mapper.h"
+#include "scheduler.h"
+#include "blockCache.h"
+#include "region.h"
+#include "observation.h"
+#include "ramSearch.h"
+#include "cheats.h"
+#include "movie.h"
+#include "audioPacing.h"
+#include "presenter.h"
+#include "capture.h"
+
+class NES;
+//generated code per NROM game, indexed by address - 0x8000. null where nothing was recompiled
+using AOTBlockTable = std::array<void(*)(NES&), 0x8000>;
+template<uint32_t ROMHash> struct AOTProgram;
+
+//owning pointer that gives a copy of its owner a copy of the object, made by T::Clone()
+template<typename T>
+class ClonedPtr : public std::unique_ptr<T>
+{
+public:
+    ClonedPtr() = default;
+    ClonedPtr(std::unique_ptr<T> pointer) : std::unique_ptr<T>(std::move(pointer)) {}
+    ClonedPtr(const ClonedPtr& other) : std::unique_ptr<T>(other ? other->Clone() : nullptr) {}
+    ClonedPtr(ClonedPtr&&) = default;
+    ClonedPtr& operator=(const ClonedPtr& other)
+    {
+        std::unique_ptr<T>::operator=(other ? other->Clone() : nullptr);
+        return *this;
+    }
+    ClonedPtr& operator=(ClonedPtr&&) = default;
+    using std::unique_ptr<T>::operator=;
+};
+
+struct NESOptions
+{
+    //no window, audio device or input polling. frames are only produced in memory
+    bool headless=false;
+    //keep the samples produced while headless for TakeAudio instead of dropping them every frame
+    bool collectAudio=false;
+    //jump over iterations of side effect free wait loops straight to the next scheduled event
+    bool skipIdleLoops=true;
+    //loop heads known to be idle loops, allowed to be longer than the detection normally accepts
+    std::vector<uint16_t> idleLoopHints;
+    //run code in PRG ROM from pre-decoded blocks instead of fetching and decoding every instruction
+    bool useBlockCache=true;
+    //run C++ recompiled by tools/nesrecomp when it was built in for the loaded NROM game
+    bool useAOT=true;
+    //what the PPU renders. the 8-bit formats fill the observation buffer read by GetObservation instead of the framebuffer
+    ObservationFormat observationFormat=OBSERVATION_RGBA;
+    //halves the observation in both directions. luminance averages each 2x2 block, palette indices keep the top left pixel
+    bool downsampleObservation=false;
+    //GetObservation returns the per pixel maximum of the last two frames, so sprites flickering every other frame stay visible
+    bool maxPoolObservation=false;
+    //scanlines added after the first vblank line, where only the CPU runs. gives games more time per frame
+    int overclockLines=0;
+    //a frame following a lag frame only works out sprite 0 hits and keeps the previous picture, see EndScanline
+    bool skipLagFrameRendering=false;
+    //how much audio Run keeps queued for the device. lower reacts faster to input sounds but underruns sooner
+    int audioLatencyMs=40;
+    //software filter the presenter scales frames with before the renderer stretches them to the window
+    UpscaleFilter upscaleFilter=UPSCALE_NONE;
+    int upscaleFactor=4;
+    //frame and lag frame counts printed when Run returns
+    bool printStats=false;
+    //input movie to write or play back in Run
+    std::string recordMovie;
+    std::string playMovie;
+    //writes every frame to capturePath.y4m, or .idx for CAPTURE_INDICES, and the audio to capturePath.wav, headless too.
+    //frames come from the framebuffer, so only with OBSERVATION_RGBA
+    std::string capturePath;
+    CaptureFormat captureFormat=CAPTURE_Y4M;
+    //Game Genie codes or raw patches applied from power on, see SetCheats
+    std::vector<std::string> cheats;
+
+    //the plain interpreter paths, used as the known good side of a lockstep run
+    static NESOptions Reference()
+    {
+        NESOptions options;
+        options.headless = true;
+        options.skipIdleLoops = false;
+        options.useBlockCache = false;
+        options.useAOT = false;
+        return options;
+    }
+};
 
 class NES
 {   
 public:
-    NES(std::ifstream& file, std::string name)
+    NES(std::ifstream& file, std::string name, NESOptions options = NESOptions()) : NES(ROMImage::Load(file), name, options)
     {
-        ParseHeader(file);
-        InitMemory(file, name);
-        InitSDL();
+    }
+
+    //instances created from the same image share its PRG and CHR data
+    NES(std::shared_ptr<const ROMImage> image, std::string name, NESOptions options = NESOptions()) : options(options), header(image->header)
+    {
+        InitMemory(image, name);
+        if(options.useAOT && header.mapperType == 0)
+            InitAOT();
+        if(!options.cheats.empty() && !SetCheats(options.cheats))
+        {
+            std::cerr << "Invalid cheat code\n";
+            exit(7);
+        }
+        if(!options.capturePath.empty())
+            StartCapture();
+        if(!options.headless)
+            InitSDL();
 
     }
     
     void Run();
     void SDLAudioCallback(Uint8* stream, int len);
 
+    //executes a single instruction and any scanline work it triggers. returns true when a frame was completed
+    bool StepInstruction();
+    void RunFrame();
+
+    //last completed frame, 256 pixels wide and GetFrameHeight() lines high. with a window the PPU draws into
+    //the presenter's buffers instead, so this only holds frames from instances without one.
+    //the frame is kept as palette indices and converted to RGBA here, the first time it's asked for
+    const uint32_t* GetFramebuffer() const;
+    //the frame as the PPU drew it, the palette colour in the low 6 bits and the PPUMASK emphasis bits above them.
+    //for callers that only hash or compare frames, which skips the conversion
+    const uint16_t* GetFrameIndices() const { return frameIndices.Read().data(); }
+    int GetFrameHeight() const { return header.isPAL ? PAL::visibleLines : NTSC::visibleLines; }
+    const uint8_t* GetRAM() const { return RAM; }
+    const uint8_t* GetSaveRAM() const { return mapper->GetSaveRAM(); }
+    //one bit per button, from bit 0: A, B, select, start, up, down, left, right
+    void SetControllerState(int player, uint8_t buttons);
+    uint8_t GetControllerState(int player) const;
+    //a lag frame is one where the game never read the controllers, usually because its logic is running behind
+    bool LastFrameLagged() const { return lastFrameLagged; }
+    uint64_t FrameCount() const { return frameCount; }
+    uint64_t LagFrameCount() const { return lagFrameCount; }
+    //samples produced since the last call, only kept while headless if options.collectAudio is set
+    std::vector<uint16_t> TakeAudio();
+
+    //size of the 8-bit observation, only used with a format other than OBSERVATION_RGBA
+    int GetObservationWidth() const { return options.downsampleObservation ? 128 : 256; }
+    int GetObservationHeight() const { return options.downsampleObservation ? GetFrameHeight() / 2 : GetFrameHeight(); }
+    //copies the last completed frame's observation, GetObservationWidth() * GetObservationHeight() bytes
+    void GetObservation(uint8_t* out) const;
+
+    //copy of the whole console state that can be run or restored later. the copy runs headless and shares the framebuffer,
+    //nametables, save RAM and CHR RAM with this instance until either side writes to them
+    std::unique_ptr<NES> Fork() const;
+    void RestoreState(const NES& snapshot);
+    //replaces the active cheats. Game Genie codes and AAAA:VV[:CC] patches to PRG ROM go through shadow copies of the
+    //patched pages, patches to RAM are written again every frame. returns false and keeps the old cheats if a code is invalid
+    bool SetCheats(const std::vector<std::string>& codes);
+
+    //64-bit hash of RAM and the CPU registers, for finding states reached twice. only pages written since the last call are rehashed
+    uint64_t StateHash();
+
 private:
+    NES(const NES&) = default;
+    NES& operator=(const NES&) = default;
+
+    friend class LockstepExecutor;
+    friend struct AOTCore;
+    template<uint32_t ROMHash> friend struct AOTProgram;
 
     struct NESregisters
     {
@@ -30,8 +182,14 @@ private:
         uint8_t accumulator;
         uint8_t Xregister;
         uint8_t Yregister;
+        //only the interrupt disable, decimal and break bits are kept here, the rest is evaluated lazily
         uint8_t processorStatus = 0;
-    } registers;
+        //N and Z are derived from the last result when processorStatus is needed
+        uint8_t negativeResult = 0;
+        uint8_t zeroResult = 1;
+        bool carry = false;
+        bool overflow = false;
+    } registers{};
     
     struct PPUstatus
     {
@@ -57,7 +215,7 @@ private:
         bool firstRead=true;
         uint8_t dataReadBuffer=0;
         uint8_t tempAddress;
-    } PPUstatus;
+    } PPUstatus{};
 
     struct SpriteData
     {
@@ -193,15 +351,40 @@ private:
         bool inhibitIRQ=false;
     } APUstatus;
 
-    void ParseHeader(std::ifstream &romFile);
-    void InitMemory(std::ifstream &romFile, std::string name);
+    void InitMemory(std::shared_ptr<const ROMImage> image, std::string name);
     void InitSDL();
-
+    void StartCapture();
+    void InitAOT();
+    void BuildCheatPages();
+    uint8_t ReadCheatedPRG(uint16_t address);
+    bool IsCheatedPage(int address) const { return address >= 0x8000 && cheatPageSlots[(address - 0x8000) >> 8]; }
+    void ApplyRAMCheats();
+    template<typename Region> void InitRegion();
+
+    void ExecuteInstruction();
     void ExecuteStep(uint8_t opcode);
+    void ExecuteBlock(size_t maxInstructions = SIZE_MAX);
+    void ExecuteDecoded(const DecodedInstruction& instruction);
+    DecodedBlock* FindBlock();
+    DecodedBlock* DecodeBlock(int bank, uint16_t address);
+    bool DispatchEvents();
+    template<typename Region> bool DispatchEvents();
+    template<typename Region> bool EndScanline(uint64_t time);
+    template<typename Region> void ScheduleAPUFrameStep(uint64_t lineEndTime);
+    template<typename Region> void StartOverclockLines();
+    //the frames of Run, on a thread of its own until running is cleared
+    void EmulationLoop(const std::atomic<bool>& running);
+    void PresentFrame();
+    //on the main thread. keys only go into frontend's pending input, false once the window was closed
+    bool PollEvents();
+    //the pending input from PollEvents, applied between frames on the emulation thread
+    void TakeInput();
 
     uint16_t Read16Bit(uint16_t address, bool incrementPC);
     uint16_t Read16BitWrapAround(uint16_t address);
     uint8_t Read8Bit(uint16_t address, bool incrementPC);
+    uint8_t FetchOperand8();
+    uint16_t FetchOperand16();
 
     void Write8Bit(uint16_t address, uint8_t value);
 
@@ -216,12 +399,18 @@ private:
     void UpdateZeroAndNegativeFlags(uint16_t result);
     void SetProcessorStatusFlag(int bitNum, bool set);
     uint8_t GetProcessorStatusFlag(int bitNum);
+    uint8_t GetProcessorStatus();
+    void SetProcessorStatus(uint8_t value);
 
     uint8_t PPUHandleRegRead(uint8_t reg);
     uint8_t PPUGet2002();
     uint8_t PPUReadMemory();
     void PPUWrite(uint8_t value);
-    void PPURenderLine();
+    template<typename Region> void PPURenderLine();
+    template<typename Region> void PPUCheckSprite0();
+    template<typename Region> void PPURenderFrameLine(uint16_t* target);
+    template<typename Region, typename Output> void PPURenderObservationLine(int line);
+    template<typename Region, typename Output> void PPURenderPixels(typename Output::Pixel* scanlinePixels);
     void PPUHandleRegisterWrite(uint8_t reg, uint8_t value);
     void CalcNameTableCoords(uint8_t& nameTable, uint8_t& x, uint8_t& y);
     void PPUGetNameTableBytes(uint8_t nametable, uint8_t x, uint8_t y, char *outBytes);
@@ -233,13 +422,16 @@ private:
     void APUQuaterClock();
     void APUHalfClock();
     void APUFrameClock();
-    void APUHandleRegisterWrite(uint16_t address, uint8_t value);
+    template<typename Region> void APUHandleRegisterWrite(uint16_t address, uint8_t value);
     uint8_t APUHandleRegisterRead(uint16_t address);
-    void UpdateDMC(); //called once per scanline, as accurate as i can get until CPU clock cycle accuracy is better 
-    void UpdateAudio();
-    void MixAudio(uint8_t* pulse1Data, uint8_t* pulse2Data, uint8_t* triangleData, uint8_t* noiseData);
-    void FillBuffers();
-    void FillPulseData(PulseAudio& pulseChannel, uint8_t* data, bool enabled);
+    void CatchUpDMC();
+    template<typename Region> void CatchUpDMC();
+    template<typename Region> void UpdateDMC(int CPUcycles);
+    template<typename Region> void ScheduleDMCFetch();
+    template<typename Region> void UpdateAudio();
+    template<typename Region> void MixAudio(uint8_t* pulse1Data, uint8_t* pulse2Data, uint8_t* triangleData, uint8_t* noiseData);
+    template<typename Region> void FillBuffers();
+    template<typename Region> void FillPulseData(PulseAudio& pulseChannel, uint8_t* data, bool enabled);
     void ClockEnvelope(bool &envelopeStart, uint8_t& decayCounter, uint8_t& volumeEnvelope, uint8_t volumeEnvelopeLoad, bool infinite, bool constantVolume);
 
     void add6502(uint8_t value);
@@ -251,6 +443,7 @@ private:
     void shift6502(bool left, bool rotate, bool acc, std::pair<uint16_t, uint16_t> valueAddress);
     void compare6502(uint8_t value, uint8_t value2);
     void branch6502(StatusFlags flag, bool set, int8_t value);
+    void CheckIdleLoop(uint16_t jumpFrom);
     void break6502();
     void jsr6502();
     void rti6502();
@@ -263,6 +456,13 @@ private:
     uint8_t GetPlayer1Bit();
     uint8_t GetPlayer2Bit();
 
+    void HandleSearchKey(SDL_Keycode key);
+    void PrintWatchChanges();
+
+    //resamples by frontend->resampleRatio and queues whole blocks for the device
+    void QueueSample(uint16_t sample);
+    size_t QueuedAudioSamples();
+
     void DebugPrint();
     void DebugShowMemory(std::string page);
     void DebugPrintTables();
@@ -271,81 +471,184 @@ private:
 
     //void DebugRenderAllNametables();
 
-    std::unique_ptr<NESMapper> mapper;
-
-    char nesMemory[0x10000];
-    char PPUPalette[0x20];
-    char PPUOAM[256];
+    //hot state touched by the interpreter on every instruction, kept together right after registers and PPUstatus
+    //PPU cycles since power on
+    uint64_t masterClock=0;
+    Scheduler scheduler;
     int scanline=0;
-    int PPUcycles=0;
-    const int PPUcyclesPerLine=341;
-
+    //line rendered by the last StepInstruction call, -1 if none
+    int lastRenderedLine=-1;
+    static constexpr int PPUcyclesPerLine=341;
+    ClonedPtr<NESMapper> mapper;
+    //operand bytes of the decoded instruction being executed, null when interpreting
+    const uint8_t* decodedOperand=nullptr;
+    const AOTBlockTable* aotBlocks=nullptr;
+    //some PRG ROM page is patched by a cheat, reads from $8000 up check for shadow pages
+    bool cheatsActive=false;
+    //makes generated code return after every instruction, for StepInstruction
+    bool aotSingleStep=false;
+    //when set, every CPU write is appended here
+    std::vector<std::pair<uint16_t, uint8_t>>* writeLog=nullptr;
+    CopyOnWrite<std::vector<uint16_t>> frameIndices;
+    //RGBA copy of frameIndices made by GetFramebuffer, stale once another line is drawn
+    mutable CopyOnWrite<std::vector<uint32_t>> framebuffer;
+    mutable bool framebufferStale=true;
+    //8-bit frames for the observation formats. the one being rendered and the one completed before it
+    CopyOnWrite<std::vector<uint8_t>> observationFrames[2];
+    int observationFrame=0;
+    //the two full width lines being downsampled into one
+    uint8_t observationLines[2][256];
+    uint8_t numSpritesOnScanLine=0;
+    //set by reads from $4016 and $4017
+    bool inputPolled=false;
+    //set by writes to the PPU registers and OAM DMA, which covers scroll, VRAM and OAM updates
+    bool PPUwritten=false;
+    //the mapper's CHRBankGeneration when the last frame ended
+    uint32_t lastCHRBankGeneration=0;
+    bool lastFrameLagged=false;
+    bool skipFrameRendering=false;
+    //the frame that just ended was drawn, a skipped one has nothing new to present
+    bool lastFrameDrawn=false;
+    uint64_t frameCount=0;
+    uint64_t lagFrameCount=0;
+    int overclockLinesLeft=0;
+
+    //state at the last arrival at a backward jump target, cleared by anything a wait loop wouldn't do
+    struct IdleLoopState
+    {
+        int32_t head=-1;
+        uint64_t arrivalClock;
+        bool clean=false;
+        uint8_t accumulator;
+        uint8_t Xregister;
+        uint8_t Yregister;
+        uint8_t stackPointer;
+        uint8_t status;
+        uint8_t PPUbits;
+    } idleLoop;
+    uint64_t idleCyclesSkipped=0;
+    BlockCache blockCache;
+    NESOptions options;
     Header header;
 
-    //differ depending on NTSC or PAL
-    int numVBlankLines;
-    int numTotalLines;
-    float msPerFrame;
-
-    std::vector<SpriteData> spritesOnScanLine;
-
-    SDL_Window* win;
-    SDL_Surface* windowSurface;
-    SDL_Texture* nesTexture;
-    SDL_Rect stretchRect;
-    SDL_Renderer *renderer;
-    std::unique_ptr<uint32_t[]> nesPixels;
-    std::unique_ptr<uint8_t[]> audioData;
-
-    //debug window
-    /*
-    SDL_Window *debugWin;
-    SDL_Texture *debugnesTexture;
-    SDL_Renderer *debugRenderer;
-    std::unique_ptr<uint32_t[]> debugnesPixels;
-    */
-    bool strobingControllers;
-    uint8_t player1ReadCount;
-    uint8_t player2ReadCount;
+    //2KB of internal RAM, the last byte written to each PPU register and the rest of the console's memory
+    uint8_t RAM[0x800]{};
+    //one bit per 256 byte page of RAM written since StateHash last hashed it
+    uint8_t dirtyRAMPages=0xFF;
+    uint64_t RAMPageHashes[8]{};
+
+    std::vector<Cheat> cheats;
+    //per 256 byte page of $8000-$FFFF, 0 when unpatched or 1 + its index in cheatShadowPages
+    uint8_t cheatPageSlots[0x80]{};
+    std::vector<std::array<uint8_t, 0x100>> cheatShadowPages;
+    //the PRG banks the shadow pages were copied from
+    uint32_t cheatPagesGeneration=0;
+    //recompiled code for this PRG, unused while cheats patch it
+    const AOTBlockTable* aotProgram=nullptr;
+    uint8_t PPUregisterShadow[8]{};
+    uint8_t PPUPalette[0x20]{};
+    uint8_t PPUOAM[256]{};
+    SpriteData spritesOnScanLine[8];
+
+    bool strobingControllers=false;
+    uint8_t player1ReadCount=0;
+    uint8_t player2ReadCount=0;
     ControllerData currentStatePlayer1;
     ControllerData prevStatePlayer1;
     ControllerData currentStatePlayer2;
     ControllerData prevStatePlayer2;
 
-    PulseAudio pulse1;
-    PulseAudio pulse2;
-    TriangleAudio triangle;
-    NoiseAudio noise;
-    DMCAudio DMC;
+    PulseAudio pulse1{};
+    PulseAudio pulse2{};
+    TriangleAudio triangle{};
+    NoiseAudio noise{};
+    DMCAudio DMC{};
 
-    SDL_AudioSpec want, have;
-    SDL_AudioDeviceID device;
-
-    std::queue<std::array<uint16_t,512>> audioDataQueue;
-    std::array<uint16_t,512> partialData;
-    uint16_t partialCounter=0;
-
-    uint16_t APUDivider;
-    uint16_t APUDividerReload;
+    uint16_t APUDivider=0;
+    uint16_t APUDividerReload=0;
     int APUscanlineTiming=0;
     int APUstage=0;
     int DMCClockCycles=0;
-    bool APUDividerReloadFlag;
-    bool DMCinterrupt;
-    bool frameInterrupt;
-    
-    const std::string debugInstructionToString[57] = {
+    uint64_t DMClastClock=0;
+    bool APUDividerReloadFlag=false;
+    bool DMCinterrupt=false;
+    bool frameInterrupt=false;
+    //per instance so parallel instances don't share the noise channel's random sequence
+    std::minstd_rand noiseRandom;
+
+    //cold state only needed for presenting frames and audio. lives on the heap so it doesn't sit between the hot fields
+    struct Frontend
+    {
+        SDL_Window* win=nullptr;
+        SDL_Surface* windowSurface=nullptr;
+        SDL_Rect stretchRect;
+        //renders on the main thread while the emulation runs on its own, PresentFrame only hands it the finished frame
+        Presenter presenter;
+        //gets every frame at its end and every sample as it's mixed
+        Capture capture;
+
+        //debug window
+        /*
+        SDL_Window *debugWin;
+        SDL_Texture *debugnesTexture;
+        SDL_Renderer *debugRenderer;
+        std::unique_ptr<uint32_t[]> debugnesPixels;
+        */
+
+        SDL_AudioSpec want, have;
+        SDL_AudioDeviceID device=0;
+
+        //shared with the audio thread, which reads from the front block starting at audioReadOffset
+        std::mutex audioMutex;
+        std::queue<std::array<uint16_t,512>> audioDataQueue;
+        size_t audioReadOffset=0;
+        uint16_t lastPlayedSample=0;
+        //underruns before the first samples arrive don't count
+        bool audioPlaying=false;
+        std::chrono::steady_clock::time_point lastAudioCallback;
+        std::array<uint16_t,512> partialData;
+        uint16_t partialCounter=0;
+
+        //set by pacer every frame. emulated samples are interpolated between previousSample and the newest one
+        AudioPacer pacer;
+        double resampleRatio=1.0;
+        double resamplePhase=0;
+        uint16_t previousSample=0;
+
+        double CPUtime = 0;
+        double PPUtime = 0;
+        double Audiotime = 0;
+        double SDLtime = 0;
+
+        //driven by the function keys, see HandleSearchKey
+        RAMSearch ramSearch;
+        Movie movie;
+        //Tab is held, frames run as fast as possible and lag frames aren't presented
+        bool turbo=false;
+
+        //keyboard state and function keys PollEvents saw since the last TakeInput
+        std::mutex inputMutex;
+        ControllerData keyboard[2];
+        bool keyboardTurbo=false;
+        std::vector<SDL_Keycode> searchKeys;
+
+        //the window and audio device stay with the instance that opened them, copies start without any
+        std::unique_ptr<Frontend> Clone() const { return std::make_unique<Frontend>(); }
+    };
+    ClonedPtr<Frontend> frontend{std::make_unique<Frontend>()};
+
+    static constexpr const char* debugInstructionToString[57] = {
         "ADC", "AND", "ASL", "BCC", "BCS", "BEQ", "BIT", "BMI", "BNE", "BPL", "BRK", "BVC", "BVS", "CLC", "CLD", "CLI", "CLV", "CMP", "CPX", "CPY",
         "DEC", "DEX", "DEY", "EOR", "INC", "INX", "INY", "JMP", "JSR", "LDA", "LDX", "LDY", "LSR", "NOP", "ORA", "PHA", "PHP", "PLA", "PLP", "ROL",
         "ROR", "RTI", "RTS", "SBC", "SEC", "SED", "SEI", "STA", "STX", "STY", "TAX", "TAY", "TSX", "TXA", "TXS", "TYA", "INVALID_INSTRUCTION"};
-    const std::string debugAddressModeToString[15] = {
+    static constexpr const char* debugAddressModeToString[15] = {
         "ACCUMULATOR", "J_ABSOLUTE", "ABSOLUTE", "ABSOLUTE_X_INDEX", "ABSOLUTE_Y_INDEX", "IMMEDIATE", "IMPLIED", "INDIRECT",
         "INDIRECT_X_INDEX", "INDIRECT_Y_INDEX", "RELATIVE", "ZEROPAGE", "ZEROPAGE_X_INDEX", "ZEROPAGE_Y_INDEX", "INVALID_ADDRESS_MODE"
     };
 
     bool debug = false;
     //bool debugHighlightPixel[4][240][256];
-    const RGB nesPalette[0x40] = {
+    static constexpr RGB nesPalette[0x40] = {
         RGB{124,124,124,255},
         RGB{0,0,252,255},
         RGB{0,0,188,255},
@@ -411,4 +714,45 @@ private:
         RGB{0,0,0,255},
         RGB{0,0,0,255}
     };
-};
\ No newline at end of file
+
+    //brightness of each palette color, using the Rec. 601 weights
+    static constexpr std::array<uint8_t, 0x40> luminancePalette = []
+    {
+        std::array<uint8_t, 0x40> luminance{};
+        for(int i=0; i<0x40; i++)
+            luminance[i] = (nesPalette[i].r * 299 + nesPalette[i].g * 587 + nesPalette[i].b * 114 + 500) / 1000;
+        return luminance;
+    }();
+
+    //the colours GetFramebuffer returns, RGBA in memory order
+    static constexpr std::array<uint32_t, 0x40> RGBAPalette = []
+    {
+        std::array<uint32_t, 0x40> rgba{};
+        for(int i=0; i<0x40; i++)
+            rgba[i] = (uint32_t)nesPalette[i].a << 24 | nesPalette[i].b << 16 | nesPalette[i].g << 8 | nesPalette[i].r;
+        return rgba;
+    }();
+
+    //what PPURenderPixels writes for a palette color, one per observation format
+
+    //the framebuffer's palette colour, PPURenderFrameLine adds the emphasis bits above it
+    struct FrameIndexPixels
+    {
+        using Pixel = uint16_t;
+        static Pixel FromColor(uint8_t nesColor) { return nesColor; }
+    };
+
+    struct IndexPixels
+    {
+        using Pixel = uint8_t;
+        static constexpr bool averageable = false;
+        static Pixel FromColor(uint8_t nesColor) { return nesColor; }
+    };
+
+    struct LuminancePixels
+    {
+        using Pixel = uint8_t;
+        static constexpr bool averageable = true;
+        static Pixel FromColor(uint8_t nesColor) { return luminancePalette[nesColor]; }
+    };
+};
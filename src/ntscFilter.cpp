@@ -0,0 +1,141 @@
+#include "ntscFilter.h"
+#include <algorithm>
+#include <cmath>
+#include <array>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+//the composite signal, following the NESdev wiki's NTSC video page. every pixel is 8 samples at 12 times the colour
+//subcarrier frequency, and a colour is a square wave between two levels that is high for half of the 12 phases
+static constexpr std::array<float, 4> lowLevels{0.350f, 0.518f, 0.962f, 1.550f};
+static constexpr std::array<float, 4> highLevels{1.094f, 1.506f, 1.962f, 1.962f};
+static constexpr float black = 0.518f, white = 1.962f;
+//emphasis lowers the signal during the part of the cycle belonging to its colour
+static constexpr float emphasisAttenuation = 0.746f;
+//decoder settings, picked to match nesPalette on flat areas
+static constexpr float hue = 4.0f, saturation = 2.0f;
+
+static bool InColorPhase(int color, int phase)
+{
+    return (color + phase) % 12 < 6;
+}
+
+//signal level of a 9 bit index at a phase, 0 for black and 1 for white
+static float Signal(int index, int phase)
+{
+    int color = index & 0x0F;
+    int level = color > 13 ? 1 : (index >> 4) & 3;
+    int emphasis = index >> 6;
+    float low = lowLevels[level];
+    float high = highLevels[level];
+    //colour 0 is a flat grey at the high level, colours 13 and up flat at the low one
+    if(color == 0)
+        low = high;
+    if(color > 12)
+        high = low;
+    float signal = InColorPhase(color, phase) ? high : low;
+    if(((emphasis & 1) && InColorPhase(0, phase)) || ((emphasis & 2) && InColorPhase(4, phase)) || ((emphasis & 4) && InColorPhase(8, phase)))
+        signal *= emphasisAttenuation;
+    return (signal - black) / (white - black);
+}
+
+//every output pixel is decoded from the 12 samples, one subcarrier cycle, around it. output 2 * x + offset takes
+//samples [8 * x + 4 * offset - 3, 8 * x + 4 * offset + 8], which reaches pixels x - 1 to x + 1 for offsets 0 and 1
+static constexpr int kernelOffsets = 5;
+//a pixel starts at phase 0, 4 or 8
+static constexpr int kernelPhases = 3;
+
+NTSCFilter::NTSCFilter(int redShift, int numThreads)
+    : kernels(512 * kernelPhases * kernelOffsets * 4, 0), pool(numThreads)
+{
+    const double pi = std::acos(-1.0);
+    for(int index=0; index<512; index++)
+    {
+        for(int phase=0; phase<kernelPhases; phase++)
+        {
+            for(int offset=-2; offset<=2; offset++)
+            {
+                //samples of this pixel inside the output's window
+                int first = std::max(0, 4 * offset - 3);
+                int last = std::min(7, 4 * offset + 8);
+                double y = 0, i = 0, q = 0;
+                for(int sample=first; sample<=last; sample++)
+                {
+                    int samplePhase = phase * 4 + sample;
+                    double signal = Signal(index, samplePhase % 12) / 12;
+                    y += signal;
+                    i += signal * std::cos(pi * (samplePhase + hue) / 6);
+                    q += signal * std::sin(pi * (samplePhase + hue) / 6);
+                }
+                i *= saturation;
+                q *= saturation;
+                //channels as 8.8 fixed point, in the order they sit in the pixel's bytes
+                int32_t* kernel = &kernels[((index * kernelPhases + phase) * kernelOffsets + offset + 2) * 4];
+                kernel[redShift / 8] = std::lround((y + 0.946882 * i + 0.623557 * q) * 255 * 256);
+                kernel[1] = std::lround((y - 0.274788 * i - 0.635691 * q) * 255 * 256);
+                kernel[2 - redShift / 8] = std::lround((y - 1.108545 * i + 1.709007 * q) * 255 * 256);
+            }
+        }
+    }
+}
+
+void NTSCFilter::Row(const uint16_t* indices, int width, int phase, uint32_t* destination, std::vector<int32_t>& sums) const
+{
+    //two outputs of padding on either side, anything past the edges is black. 128 rounds the shift at the end
+    sums.assign((width * 2 + 4) * 4, 128);
+    for(int x=0; x<width; x++)
+    {
+        const int32_t* kernel = &kernels[((indices[x] & 0x1FF) * kernelPhases + phase / 4) * kernelOffsets * 4];
+        int32_t* sum = &sums[x * 2 * 4];
+#ifdef __SSE2__
+        for(int offset=0; offset<kernelOffsets; offset++)
+        {
+            __m128i accumulated = _mm_loadu_si128((const __m128i*)(sum + offset * 4));
+            __m128i added = _mm_loadu_si128((const __m128i*)(kernel + offset * 4));
+            _mm_storeu_si128((__m128i*)(sum + offset * 4), _mm_add_epi32(accumulated, added));
+        }
+#else
+        for(int channel=0; channel<kernelOffsets * 4; channel++)
+            sum[channel] += kernel[channel];
+#endif
+        phase = (phase + 8) % 12;
+    }
+
+    const int32_t* outputs = &sums[2 * 4];
+    int x = 0;
+#ifdef __SSE2__
+    //four pixels at a time, shifted out of fixed point and saturated to bytes
+    const __m128i alpha = _mm_set1_epi32(0xFF000000);
+    for(; x + 4 <= width * 2; x += 4)
+    {
+        __m128i p0 = _mm_srai_epi32(_mm_loadu_si128((const __m128i*)(outputs + x * 4)), 8);
+        __m128i p1 = _mm_srai_epi32(_mm_loadu_si128((const __m128i*)(outputs + x * 4 + 4)), 8);
+        __m128i p2 = _mm_srai_epi32(_mm_loadu_si128((const __m128i*)(outputs + x * 4 + 8)), 8);
+        __m128i p3 = _mm_srai_epi32(_mm_loadu_si128((const __m128i*)(outputs + x * 4 + 12)), 8);
+        __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(p0, p1), _mm_packs_epi32(p2, p3));
+        _mm_storeu_si128((__m128i*)(destination + x), _mm_or_si128(bytes, alpha));
+    }
+#endif
+    for(; x < width * 2; x++)
+    {
+        uint32_t pixel = 0xFF000000;
+        for(int channel=0; channel<3; channel++)
+            pixel |= (uint32_t)std::clamp(outputs[x * 4 + channel] >> 8, 0, 255) << (channel * 8);
+        destination[x] = pixel;
+    }
+}
+
+void NTSCFilter::Run(const uint16_t* indices, int width, int height, int framePhase, uint32_t* destination, int pitch)
+{
+    size_t bands = std::min<size_t>(height, pool.NumThreads() * 4);
+    rowSums.resize(bands);
+    pool.ParallelFor(bands, [&](size_t band)
+    {
+        int first = height * band / bands;
+        int last = height * (band + 1) / bands;
+        //a line is 341 pixels, which moves the phase on by 4 every line
+        for(int y=first; y<last; y++)
+            Row(indices + y * width, width, (framePhase + y * 4) % 12, destination + y * pitch, rowSums[band]);
+    });
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include "threadPool.h"
+#include <cstdint>
+#include <vector>
+
+//turns palette indices into the picture an NTSC television decodes from the PPU's composite signal, including the
+//colour fringes on sharp edges and the dot crawl. the output is twice as wide as the input.
+//each index is a 9 bit value, the palette colour in the low 6 bits and the three emphasis bits above it
+class NTSCFilter
+{
+public:
+    //redShift is where the red channel sits in a pixel, 16 for ARGB8888 and 0 for RGBA32
+    NTSCFilter(int redShift, int numThreads);
+
+    //the colour subcarrier phase the frame starts at moves by a third of a cycle every other frame
+    static int FramePhase(uint64_t frameNumber) { return (frameNumber & 1) * 4; }
+    //width by height indices into 2 * width by height pixels with lines pitch pixels apart
+    void Run(const uint16_t* indices, int width, int height, int framePhase, uint32_t* destination, int pitch);
+
+private:
+    void Row(const uint16_t* indices, int width, int phase, uint32_t* destination, std::vector<int32_t>& sums) const;
+
+    //for every index, pixel phase and output the pixel overlaps, what it adds to that output's channels, 4 per entry
+    std::vector<int32_t> kernels;
+    WorkStealingPool pool;
+    //output sums for each band of rows, kept between frames
+    std::vector<std::vector<int32_t>> rowSums;
+};
@@ -0,0 +1,66 @@
+#include "observation.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+//rounds up like _mm_avg_epu8, so both paths give the same result
+static inline uint8_t Average(uint8_t a, uint8_t b)
+{
+    return (a + b + 1) >> 1;
+}
+
+void DownsampleLines(const uint8_t* top, const uint8_t* bottom, uint8_t* out, int width)
+{
+    int i = 0;
+#ifdef __SSE2__
+    const __m128i lowBytes = _mm_set1_epi16(0x00FF);
+    for(; i + 32 <= width; i += 32)
+    {
+        __m128i first = _mm_avg_epu8(_mm_loadu_si128((const __m128i*)(top + i)), _mm_loadu_si128((const __m128i*)(bottom + i)));
+        __m128i second = _mm_avg_epu8(_mm_loadu_si128((const __m128i*)(top + i + 16)), _mm_loadu_si128((const __m128i*)(bottom + i + 16)));
+        //average each even pixel with the odd one after it
+        first = _mm_avg_epu16(_mm_and_si128(first, lowBytes), _mm_srli_epi16(first, 8));
+        second = _mm_avg_epu16(_mm_and_si128(second, lowBytes), _mm_srli_epi16(second, 8));
+        _mm_storeu_si128((__m128i*)(out + i / 2), _mm_packus_epi16(first, second));
+    }
+#endif
+    for(; i + 1 < width; i += 2)
+        out[i / 2] = Average(Average(top[i], bottom[i]), Average(top[i + 1], bottom[i + 1]));
+}
+
+void DecimateLine(const uint8_t* line, uint8_t* out, int width)
+{
+    int i = 0;
+#ifdef __SSE2__
+    const __m128i lowBytes = _mm_set1_epi16(0x00FF);
+    for(; i + 32 <= width; i += 32)
+    {
+        __m128i first = _mm_and_si128(_mm_loadu_si128((const __m128i*)(line + i)), lowBytes);
+        __m128i second = _mm_and_si128(_mm_loadu_si128((const __m128i*)(line + i + 16)), lowBytes);
+        _mm_storeu_si128((__m128i*)(out + i / 2), _mm_packus_epi16(first, second));
+    }
+#endif
+    for(; i + 1 < width; i += 2)
+        out[i / 2] = line[i];
+}
+
+void MaxPool(const uint8_t* a, const uint8_t* b, uint8_t* out, size_t size)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    for(; i + 16 <= size; i += 16)
+    {
+        __m128i max = _mm_max_epu8(_mm_loadu_si128((const __m128i*)(a + i)), _mm_loadu_si128((const __m128i*)(b + i)));
+        _mm_storeu_si128((__m128i*)(out + i), max);
+    }
+#endif
+    for(; i < size; i++)
+        out[i] = a[i] > b[i] ? a[i] : b[i];
+}
+
+void IndicesToColors(const uint16_t* indices, size_t count, const uint32_t* palette, uint32_t* out)
+{
+    //a load and a store per pixel with the palette in L1. SSSE3 table lookups on byte planes measured slower than this
+    for(size_t i=0; i<count; i++)
+        out[i] = palette[indices[i] & 0x3F];
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+//what the PPU renders each line into
+enum ObservationFormat
+{
+    OBSERVATION_RGBA, //the normal 32-bit framebuffer
+    OBSERVATION_PALETTE_INDEX, //one byte per pixel holding the NES color index
+    OBSERVATION_LUMINANCE //one byte per pixel holding the color's brightness
+};
+
+//kernels for the 8-bit observation buffers, SSE2 where available
+
+//averages each 2x2 block of two lines into one pixel of a line half as wide
+void DownsampleLines(const uint8_t* top, const uint8_t* bottom, uint8_t* out, int width);
+//keeps every other pixel of a line, for data that can't be averaged
+void DecimateLine(const uint8_t* line, uint8_t* out, int width);
+//per pixel maximum of two frames
+void MaxPool(const uint8_t* a, const uint8_t* b, uint8_t* out, size_t size);
+
+//colours of a run of framebuffer indices. the emphasis bits above the palette colour are ignored
+void IndicesToColors(const uint16_t* indices, size_t count, const uint32_t* palette, uint32_t* out);
@@ -0,0 +1,49 @@
+#pragma once
+#include <cstdint>
+
+//CPU cycles charged per opcode, the same costs the handlers used to add themselves
+inline constexpr uint8_t opcodeCycles[256] = {
+    7, 2, 0, 0, 0, 2, 2, 0, 3, 2, 2, 0, 0, 2, 2, 0,
+    2, 2, 0, 0, 0, 2, 2, 0, 2, 2, 0, 0, 0, 2, 2, 0,
+    6, 2, 0, 0, 3, 2, 2, 0, 4, 2, 2, 0, 3, 2, 2, 0,
+    2, 2, 0, 0, 0, 2, 2, 0, 2, 2, 0, 0, 0, 2, 2, 0,
+    6, 2, 0, 0, 0, 2, 2, 0, 3, 2, 2, 0, 3, 2, 2, 0,
+    2, 2, 0, 0, 0, 2, 2, 0, 2, 2, 0, 0, 0, 2, 2, 0,
+    6, 2, 0, 0, 0, 2, 2, 0, 4, 2, 2, 0, 3, 2, 2, 0,
+    2, 2, 0, 0, 0, 2, 2, 0, 2, 2, 0, 0, 0, 2, 2, 0,
+    0, 3, 0, 0, 3, 3, 3, 0, 3, 0, 2, 0, 3, 3, 3, 0,
+    2, 3, 0, 0, 3, 3, 3, 0, 2, 3, 2, 0, 0, 3, 0, 0,
+    2, 2, 2, 0, 2, 2, 2, 0, 2, 2, 2, 0, 2, 2, 2, 0,
+    2, 2, 0, 0, 2, 2, 2, 0, 2, 2, 2, 0, 2, 2, 2, 0,
+    2, 2, 0, 0, 2, 2, 5, 0, 3, 2, 3, 0, 2, 2, 5, 0,
+    2, 2, 0, 0, 0, 2, 5, 0, 2, 2, 0, 0, 0, 2, 5, 0,
+    2, 2, 0, 0, 2, 2, 5, 0, 3, 2, 2, 0, 2, 2, 5, 0,
+    2, 2, 0, 0, 0, 2, 5, 0, 2, 2, 0, 0, 0, 2, 5, 0,
+};
+
+//instruction length in bytes, opcode included
+inline constexpr uint8_t opcodeLengths[256] = {
+    1, 2, 1, 2, 2, 2, 2, 2, 1, 2, 1, 2, 3, 3, 3, 3,
+    2, 2, 1, 2, 2, 2, 2, 2, 1, 3, 1, 3, 3, 3, 3, 3,
+    3, 2, 1, 2, 2, 2, 2, 2, 1, 2, 1, 2, 3, 3, 3, 3,
+    2, 2, 1, 2, 2, 2, 2, 2, 1, 3, 1, 3, 3, 3, 3, 3,
+    1, 2, 1, 2, 2, 2, 2, 2, 1, 2, 1, 2, 3, 3, 3, 3,
+    2, 2, 1, 2, 2, 2, 2, 2, 1, 3, 1, 3, 3, 3, 3, 3,
+    1, 2, 1, 2, 2, 2, 2, 2, 1, 2, 1, 2, 3, 3, 3, 3,
+    2, 2, 1, 2, 2, 2, 2, 2, 1, 3, 1, 3, 3, 3, 3, 3,
+    2, 2, 2, 2, 2, 2, 2, 2, 1, 2, 1, 2, 3, 3, 3, 3,
+    2, 2, 1, 2, 2, 2, 2, 2, 1, 3, 1, 3, 3, 3, 3, 3,
+    2, 2, 2, 2, 2, 2, 2, 2, 1, 2, 1, 2, 3, 3, 3, 3,
+    2, 2, 1, 2, 2, 2, 2, 2, 1, 3, 1, 3, 3, 3, 3, 3,
+    2, 2, 2, 2, 2, 2, 2, 2, 1, 2, 1, 2, 3, 3, 3, 3,
+    2, 2, 1, 2, 2, 2, 2, 2, 1, 3, 1, 3, 3, 3, 3, 3,
+    2, 2, 2, 2, 2, 2, 2, 2, 1, 2, 1, 2, 3, 3, 3, 3,
+    2, 2, 1, 2, 2, 2, 2, 2, 1, 3, 1, 3, 3, 3, 3, 3,
+};
+
+//opcodes after which the next instruction isn't necessarily the following one
+inline constexpr bool IsControlFlowOpcode(uint8_t opcode)
+{
+    return (opcode & 0x1F) == 0x10 || opcode == 0x00 || opcode == 0x20 || opcode == 0x40 ||
+           opcode == 0x4C || opcode == 0x60 || opcode == 0x6C;
+}
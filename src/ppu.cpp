@@ -20,7 +20,7 @@ uint8_t NES::PPUHandleRegRead(uint8_t reg)
     case 1:
     case 3:
     case 5:
-    case 6: return nesMemory[reg + 0x2000];
+    case 6: return PPUregisterShadow[reg];
     case 2: return PPUGet2002();
     case 4: return PPUOAM[PPUstatus.OAMcurrentAddress];
     case 7: return PPUReadMemory();
@@ -104,7 +104,7 @@ void NES::PPUWrite(uint8_t value)
 
         if (!(temp & 0x0003))
             temp &= 0x3F0F;
-        PPUPalette[temp-0x3F00] = value;
+        PPUPalette[temp-0x3F00] = value & 0x3F;
     }
     else
         mapper->WritePPU(temp, value);
@@ -114,17 +114,88 @@ void NES::PPUWrite(uint8_t value)
         PPUstatus.VRAMaddress++;
 }
 
+template<typename Region>
 void NES::PPURenderLine()
 {
-    Uint32 *scanlinePixels = (Uint32 *)(nesPixels.get());
-    scanlinePixels += (scanline - (header.isPAL ? 0 : 8)) * 256;
+    if(skipFrameRendering)
+        return PPUCheckSprite0<Region>();
 
+    int line = scanline - Region::firstVisibleLine;
+    switch(options.observationFormat)
+    {
+    case OBSERVATION_RGBA:
+        //with a window, straight into the presenter's back buffer, which turns it into pixels on its own thread
+        if(frontend->presenter.Running())
+            PPURenderFrameLine<Region>(frontend->presenter.BackIndices() + line * 256);
+        else
+        {
+            PPURenderFrameLine<Region>(frameIndices.Write().data() + line * 256);
+            framebufferStale = true;
+        }
+    break;
+    case OBSERVATION_PALETTE_INDEX:
+        PPURenderObservationLine<Region, IndexPixels>(line);
+    break;
+    case OBSERVATION_LUMINANCE:
+        PPURenderObservationLine<Region, LuminancePixels>(line);
+    break;
+    }
+}
+
+//the picture isn't needed, but games time raster effects off sprite 0 hits, so lines sprite 0 is on are still drawn
+template<typename Region>
+void NES::PPUCheckSprite0()
+{
     if(!PPUstatus.displayBackground && !PPUstatus.displaySprites)
+        return;
+
+    UpdateSprites();
+    //sprites are found in OAM order, so sprite 0 always comes first
+    if(numSpritesOnScanLine > 0 && spritesOnScanLine[0].id == 0)
     {
-        RGB color = nesPalette[GetBackDropColor()];
+        uint16_t scratch[256];
+        PPURenderPixels<Region, FrameIndexPixels>(scratch);
+    }
+}
+
+template<typename Region>
+void NES::PPURenderFrameLine(uint16_t* target)
+{
+    PPURenderPixels<Region, FrameIndexPixels>(target);
+    //only the NTSC filter shows emphasis, the plain palette has no colours for it
+    if(PPUstatus.backgroundColorIntensity)
+        for(int x=0; x<256; x++)
+            target[x] |= PPUstatus.backgroundColorIntensity << 6;
+}
+
+template<typename Region, typename Output>
+void NES::PPURenderObservationLine(int line)
+{
+    uint8_t* frame = observationFrames[observationFrame].Write().data();
+    if(!options.downsampleObservation)
+        return PPURenderPixels<Region, Output>(frame + line * 256);
+
+    //pairs of lines are rendered into the line buffers and shrunk into one output line once the second is done
+    PPURenderPixels<Region, Output>(observationLines[line & 1]);
+    if(line & 1)
+    {
+        uint8_t* out = frame + (line / 2) * 128;
+        if(Output::averageable)
+            DownsampleLines(observationLines[0], observationLines[1], out, 256);
+        else
+            DecimateLine(observationLines[0], out, 256);
+    }
+}
+
+template<typename Region, typename Output>
+void NES::PPURenderPixels(typename Output::Pixel* scanlinePixels)
+{
+    if(!PPUstatus.displayBackground && !PPUstatus.displaySprites)
+    {
+        auto color = Output::FromColor(GetBackDropColor());
         for (int i = 0; i<256; i++)
         {
-            scanlinePixels[i] = *((Uint32 *)&color);
+            scanlinePixels[i] = color;
         }
         return;
     }
@@ -182,16 +253,14 @@ void NES::PPURenderLine()
                 int pixelPos = i * 8 + j - nametableXOffset;
                 if (pixelPos >=0 && pixelPos < 8 && !PPUstatus.showLeft8PixelsBackground)
                 {
-                    RGB color = nesPalette[GetBackDropColor()];
-                    scanlinePixels[pixelPos] = *((Uint32 *)&color);
+                    scanlinePixels[pixelPos] = Output::FromColor(GetBackDropColor());
                 }
                 else if (pixelPos >= 0 && pixelPos < 256)
                 {
                     if (paletteIndex)
                         opaqueBackground[i * 8 + j] = true;
                     uint8_t nesColor = GetBackgroundColor(attributeTableBytes[(i+attributeTableXOffset)/4], nametableX, nametableY, paletteIndex);
-                    RGB color = nesPalette[nesColor];
-                    scanlinePixels[pixelPos] = *((Uint32 *)&color);
+                    scanlinePixels[pixelPos] = Output::FromColor(nesColor);
                 }
 
 
@@ -208,18 +277,18 @@ void NES::PPURenderLine()
     }
     else
     {
-        RGB color = nesPalette[PPUPalette[0]];
+        auto color = Output::FromColor(PPUPalette[0]);
         for (int i = 0; i < 256; i++)
         {
-            scanlinePixels[i] = *((Uint32 *)&color);
+            scanlinePixels[i] = color;
         }
     }
 
 
-    if (!PPUstatus.displaySprites || (scanline - (header.isPAL ? 0 : 8)) == 0)
+    if (!PPUstatus.displaySprites || scanline == 0)
         return;
 
-    for(int j = spritesOnScanLine.size()-1; j>=0; j--)
+    for(int j = numSpritesOnScanLine-1; j>=0; j--)
     {
         auto sprite = spritesOnScanLine[j];
         int yPos = (scanline) - sprite.yPos;
@@ -278,8 +347,7 @@ void NES::PPURenderLine()
                 if(((!(sprite.attributes & 0b100000)) || (!opaqueBackground[pixelPos])) && paletteIndex!=0)
                 {
                     uint8_t nesColor = GetSpriteColor(sprite.attributes, paletteIndex);
-                    RGB color = nesPalette[nesColor];
-                    scanlinePixels[pixelPos] = *((Uint32 *)&color);
+                    scanlinePixels[pixelPos] = Output::FromColor(nesColor);
                 }
 
             }
@@ -287,6 +355,35 @@ void NES::PPURenderLine()
     }
 }
 
+const uint32_t* NES::GetFramebuffer() const
+{
+    if(framebufferStale)
+    {
+        std::vector<uint32_t>& pixels = framebuffer.Write();
+        const std::vector<uint16_t>& indices = frameIndices.Read();
+        pixels.resize(indices.size());
+        IndicesToColors(indices.data(), indices.size(), RGBAPalette.data(), pixels.data());
+        framebufferStale = false;
+    }
+    return framebuffer.Read().data();
+}
+
+void NES::GetObservation(uint8_t* out) const
+{
+    //the buffer being rendered still holds the frame before the last one until the next line is drawn
+    const uint8_t* latest = observationFrames[observationFrame ^ 1].Read().data();
+    size_t size = GetObservationWidth() * GetObservationHeight();
+    if(options.maxPoolObservation)
+        MaxPool(latest, observationFrames[observationFrame].Read().data(), out, size);
+    else
+        memcpy(out, latest, size);
+}
+
+template void NES::PPURenderLine<NTSC>();
+template void NES::PPURenderLine<PAL>();
+template void NES::PPUCheckSprite0<NTSC>();
+template void NES::PPUCheckSprite0<PAL>();
+
 uint8_t NES::GetBackDropColor()
 {
     if (!PPUstatus.VRAMaddress >= 0x3F00)
@@ -370,7 +467,7 @@ uint8_t NES::GetSpriteColor(uint8_t attributeByte, uint8_t paletteIndex)
 
 void NES::UpdateSprites()
 {
-    spritesOnScanLine.clear();
+    numSpritesOnScanLine = 0;
     for(int i=0; i<64; i++)
     {
         uint32_t* sprite = ((uint32_t*)PPUOAM)+i;
@@ -378,7 +475,7 @@ void NES::UpdateSprites()
         int yRange = (scanline) - yPos;
         if (yRange>=0 && yRange < (PPUstatus.is8x16Sprites ? 16 : 8))
         {
-            if(spritesOnScanLine.size()>=8)
+            if(numSpritesOnScanLine>=8)
             {
                 PPUstatus.spriteOverflow=true;
                 break;
@@ -391,7 +488,7 @@ void NES::UpdateSprites()
                 spriteData.attributes = ((uint8_t *)sprite)[2];
                 spriteData.xPos = ((uint8_t *)sprite)[3];
                 spriteData.id=i;
-                spritesOnScanLine.push_back(spriteData);
+                spritesOnScanLine[numSpritesOnScanLine++] = spriteData;
             }
         }
     }
@@ -440,7 +537,7 @@ void NES::PPUHandleRegisterWrite(uint8_t reg, uint8_t value)
         else
         {
             PPUstatus.VRAMaddress = (((uint16_t)PPUstatus.tempAddress) << 8) | value;
-            if (scanline > 0 && scanline < numTotalLines - numVBlankLines)
+            if (scanline > 0 && scanline < (header.isPAL ? PAL::firstVBlankLine : NTSC::firstVBlankLine))
             {
                 PPUstatus.currentNameTable = (PPUstatus.VRAMaddress >> 10) & 0b11;
                 PPUstatus.Yscroll = (PPUstatus.VRAMaddress >> 5) & 0b11111;
@@ -458,11 +555,11 @@ void NES::PPUHandleRegisterWrite(uint8_t reg, uint8_t value)
         if (value < 0x20)
         {
             value %= 8;
-            memcpy(temp, nesMemory + (value * 0x100), 256);
+            memcpy(temp, RAM + (value * 0x100), 256);
         }
         else if (value < 0x80)
-        {
-            memcpy(temp, nesMemory + (value * 0x100), 256);
+        {//nothing readable is mapped here
+            memset(temp, 0, 256);
         }
         else
         {
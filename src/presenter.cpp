@@ -0,0 +1,181 @@
+#include "presenter.h"
+#include "observation.h"
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+
+bool TripleBuffer::Publish()
+{
+    //release makes the frame visible to the consumer, acquire makes sure it finished reading the buffer coming back
+    uint8_t previous = middle.exchange(back | freshBit, std::memory_order_acq_rel);
+    back = previous & ~freshBit;
+    return previous & freshBit;
+}
+
+void TripleBuffer::Acquire()
+{
+    //the producer can only have published again in between, which leaves the flag set
+    front = middle.exchange(front, std::memory_order_acq_rel) & ~freshBit;
+}
+
+bool Presenter::Start(SDL_Window* window, int width, int height, SDL_Rect stretchRect, const uint32_t* palette,
+                      UpscaleFilter filter, int upscaleFactor)
+{
+    this->window = window;
+    this->width = width;
+    this->height = height;
+    this->stretchRect = stretchRect;
+    std::copy_n(palette, this->palette.size(), this->palette.begin());
+    this->filter = filter;
+    this->upscaleFactor = upscaleFactor;
+    for(auto& buffer : indexBuffers)
+        buffer.assign(width * height, 0);
+    if(!Init())
+    {
+        Stop();
+        return false;
+    }
+    running = true;
+    return true;
+}
+
+void Presenter::Stop()
+{
+    running = false;
+    if(texture)
+        SDL_DestroyTexture(texture);
+    texture = nullptr;
+    upscaler.reset();
+    ntsc.reset();
+    if(renderer)
+        SDL_DestroyRenderer(renderer);
+    renderer = nullptr;
+}
+
+void Presenter::Publish(uint64_t frameNumber)
+{
+    frameNumbers[frames.Back()] = frameNumber;
+    published++;
+    if(frames.Publish())
+        dropped++;
+}
+
+bool Presenter::Init()
+{
+    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+    if (!renderer)
+    {
+        std::cerr << "failed to create SDL renderer: " << SDL_GetError() << "\n";
+        return false;
+    }
+    SDL_RendererInfo info;
+    if(SDL_GetRendererInfo(renderer, &info) == 0)
+    {
+        vsync = info.flags & SDL_RENDERER_PRESENTVSYNC;
+        //the first format listed is the one the renderer uploads without converting
+        for(Uint32 i=0; i<info.num_texture_formats; i++)
+        {
+            if(info.texture_formats[i] == SDL_PIXELFORMAT_ARGB8888 || info.texture_formats[i] == SDL_PIXELFORMAT_RGBA32)
+            {
+                format = info.texture_formats[i];
+                break;
+            }
+        }
+    }
+    if(format == SDL_PIXELFORMAT_ARGB8888)
+    {
+        //red and blue swap places
+        for(auto& color : palette)
+            color = (color & 0xFF00FF00) | (color & 0xFF) << 16 | (color >> 16 & 0xFF);
+    }
+
+    int threads = std::max(1u, std::thread::hardware_concurrency() / 2);
+    int redShift = format == SDL_PIXELFORMAT_ARGB8888 ? 16 : 0;
+    int textureWidth = width, textureHeight = height;
+    if(filter == UPSCALE_NTSC)
+    {
+        textureWidth = width * 2;
+        ntsc = std::make_unique<NTSCFilter>(redShift, threads);
+    }
+    else if(filter != UPSCALE_NONE)
+    {
+        textureWidth = width * upscaleFactor;
+        textureHeight = height * upscaleFactor;
+        colors.assign(width * height, 0);
+        upscaler = std::make_unique<Upscaler>(filter, upscaleFactor, redShift, threads);
+    }
+    //the format, and so the texture, is only known once the renderer exists
+    texture = SDL_CreateTexture(renderer, format, SDL_TEXTUREACCESS_STREAMING, textureWidth, textureHeight);
+    if(!texture)
+    {
+        std::cerr << "failed to create SDL texture: " << SDL_GetError() << "\n";
+        return false;
+    }
+    return true;
+}
+
+void Presenter::Draw()
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    const uint16_t* indices = indexBuffers[frames.Front()].data();
+    void* memory;
+    int pitch;
+    SDL_LockTexture(texture, NULL, &memory, &pitch);
+    uint32_t* pixels = (uint32_t*)memory;
+    pitch /= sizeof(uint32_t);
+    if(ntsc)
+        ntsc->Run(indices, width, height, NTSCFilter::FramePhase(frameNumbers[frames.Front()]), pixels, pitch);
+    else if(upscaler)
+    {
+        IndicesToColors(indices, width * height, palette.data(), colors.data());
+        upscaler->Run(colors.data(), width, height, pixels, pitch);
+    }
+    else
+    {
+        for(int line=0; line<height; line++)
+            IndicesToColors(indices + line * width, width, palette.data(), pixels + line * pitch);
+    }
+    SDL_UnlockTexture(texture);
+    auto end = std::chrono::high_resolution_clock::now();
+    drawTime += std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+void Presenter::Run(const std::function<bool()>& pollEvents)
+{
+    bool anyFrame = false;
+    while(pollEvents())
+    {
+        if(frames.HasNewFrame())
+        {
+            frames.Acquire();
+            Draw();
+            anyFrame = true;
+            presented++;
+        }
+        //without vsync a present returns right away, so wait for a new frame instead of spinning on the old one
+        else if(!vsync || !anyFrame)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+        else
+            repeated++;
+        SDL_RenderCopy(renderer, texture, NULL, &stretchRect);
+        SDL_RenderPresent(renderer);
+    }
+}
+
+void Presenter::PrintStats(std::ostream& out) const
+{
+    out << "Frames published: " << published << ", presented: " << presented << ", dropped: " << dropped
+        << ", repeated: " << repeated << "\n";
+    if(presented == 0)
+        return;
+    if(filter == UPSCALE_NTSC)
+        out << "NTSC filter: " << drawTime / presented << "ms per frame\n";
+    else if(filter != UPSCALE_NONE)
+        out << "Upscaling " << upscaleFactor << "x: " << drawTime / presented << "ms per frame\n";
+    else
+        out << "Converting frames: " << drawTime / presented << "ms per frame\n";
+}
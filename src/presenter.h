@@ -0,0 +1,94 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include "upscale.h"
+#include "ntscFilter.h"
+#include <cstdint>
+#include <array>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <functional>
+#include <ostream>
+
+//three buffers passed from one producer to one consumer without either side ever waiting on the other.
+//the producer fills its back buffer and swaps it with the middle one, the consumer swaps its front buffer with the
+//middle one when a new frame is there. the middle buffer's index and whether it holds an untaken frame share one atomic
+class TripleBuffer
+{
+public:
+    int Back() const { return back; }
+    int Front() const { return front; }
+    //hands the back buffer over, returns true when the frame published before it was never taken
+    bool Publish();
+    bool HasNewFrame() const { return middle.load(std::memory_order_acquire) & freshBit; }
+    //moves the newest frame to the front, only called after HasNewFrame returned true
+    void Acquire();
+
+private:
+    static constexpr uint8_t freshBit = 4;
+    uint8_t back=0;
+    std::atomic<uint8_t> middle{1};
+    uint8_t front=2;
+};
+
+//owns the renderer and presents frames on the main thread, the only one SDL's render API is safe on, while the
+//emulation runs on a thread of its own and hands frames over without waiting, so a present blocking on vsync doesn't
+//hold it up. the PPU draws 9 bit palette indices into the buffers, half the size of finished pixels. each frame taken
+//is turned into the renderer's native format, through the filter if there is one, straight in a locked texture,
+//so frames that are replaced before being shown are never converted
+class Presenter
+{
+public:
+    ~Presenter() { Stop(); }
+    //creates the renderer and texture on the calling thread, false when SDL couldn't. palette is the 64 colours as
+    //RGBA, like NES::RGBAPalette
+    bool Start(SDL_Window* window, int width, int height, SDL_Rect stretchRect, const uint32_t* palette,
+               UpscaleFilter filter = UPSCALE_NONE, int upscaleFactor = 1);
+    //presents frames as they are published until pollEvents, called between presents to pump the window's events,
+    //returns false. on the thread that called Start
+    void Run(const std::function<bool()>& pollEvents);
+    //destroys the renderer, once nothing publishes anymore
+    void Stop();
+    bool Running() const { return running; }
+
+    //where the next frame is drawn, lines width apart
+    uint16_t* BackIndices() { return indexBuffers[frames.Back()].data(); }
+
+    //hands the finished back buffer to the presenting thread, never blocks. the frame number sets the NTSC phase
+    void Publish(uint64_t frameNumber);
+    void PrintStats(std::ostream& out) const;
+
+private:
+    bool Init();
+    //turns the front buffer into pixels in the texture
+    void Draw();
+
+    SDL_Window* window=nullptr;
+    int width=0, height=0;
+    SDL_Rect stretchRect;
+    SDL_Renderer* renderer=nullptr;
+    //SDL_PIXELFORMAT_ARGB8888 or SDL_PIXELFORMAT_RGBA32, whichever the renderer takes without converting
+    Uint32 format=SDL_PIXELFORMAT_RGBA32;
+    //the palette in that format
+    std::array<uint32_t, 64> palette{};
+    SDL_Texture* texture=nullptr;
+    std::array<std::vector<uint16_t>, 3> indexBuffers;
+    std::array<uint64_t, 3> frameNumbers{};
+    //the upscalers work on colours, which are converted into here first
+    std::vector<uint32_t> colors;
+    std::unique_ptr<Upscaler> upscaler;
+    std::unique_ptr<NTSCFilter> ntsc;
+    UpscaleFilter filter=UPSCALE_NONE;
+    int upscaleFactor=1;
+    double drawTime=0;
+    bool vsync=false;
+    TripleBuffer frames;
+    std::atomic<bool> running{false};
+
+    uint64_t published=0;
+    //published frames replaced before the presenting thread took them
+    uint64_t dropped=0;
+    uint64_t presented=0;
+    //vsyncs where no new frame was there and the previous one was shown again
+    uint64_t repeated=0;
+};
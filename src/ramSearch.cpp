@@ -0,0 +1,143 @@
+#include "ramSearch.h"
+#include "nes.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+//one bit per byte of the 64 starting at current, set where it passes the comparison
+static uint64_t CompareBlock(const uint8_t* current, const uint8_t* previous, RAMSearchCompare compare, uint8_t value)
+{
+    uint64_t mask = 0;
+#ifdef __SSE2__
+    //signed compares on values with the top bit flipped order them like unsigned ones
+    const __m128i signBits = _mm_set1_epi8((char)0x80);
+    const __m128i values = _mm_set1_epi8((char)value);
+    for(int i=0; i<64; i+=16)
+    {
+        __m128i now = _mm_loadu_si128((const __m128i*)(current + i));
+        __m128i before = _mm_loadu_si128((const __m128i*)(previous + i));
+        __m128i result;
+        switch(compare)
+        {
+        case SEARCH_EQUAL:
+            result = _mm_cmpeq_epi8(now, before);
+        break;
+        case SEARCH_NOT_EQUAL:
+            result = _mm_xor_si128(_mm_cmpeq_epi8(now, before), _mm_set1_epi8(-1));
+        break;
+        case SEARCH_GREATER:
+            result = _mm_cmpgt_epi8(_mm_xor_si128(now, signBits), _mm_xor_si128(before, signBits));
+        break;
+        case SEARCH_LESS:
+            result = _mm_cmplt_epi8(_mm_xor_si128(now, signBits), _mm_xor_si128(before, signBits));
+        break;
+        case SEARCH_DELTA:
+            result = _mm_cmpeq_epi8(_mm_sub_epi8(now, before), values);
+        break;
+        default:
+            result = _mm_cmpeq_epi8(now, values);
+        }
+        mask |= (uint64_t)(uint16_t)_mm_movemask_epi8(result) << i;
+    }
+#else
+    for(int i=0; i<64; i++)
+    {
+        bool passes;
+        switch(compare)
+        {
+        case SEARCH_EQUAL: passes = current[i] == previous[i]; break;
+        case SEARCH_NOT_EQUAL: passes = current[i] != previous[i]; break;
+        case SEARCH_GREATER: passes = current[i] > previous[i]; break;
+        case SEARCH_LESS: passes = current[i] < previous[i]; break;
+        case SEARCH_DELTA: passes = (uint8_t)(current[i] - previous[i]) == value; break;
+        default: passes = current[i] == value;
+        }
+        mask |= (uint64_t)passes << i;
+    }
+#endif
+    return mask;
+}
+
+void RAMSearch::Capture(const NES& nes, std::vector<uint8_t>& memory) const
+{
+    const uint8_t* saveRAM = nes.GetSaveRAM();
+    memory.resize(saveRAM ? 0x2800 : 0x800);
+    memcpy(memory.data(), nes.GetRAM(), 0x800);
+    if(saveRAM)
+        memcpy(memory.data() + 0x800, saveRAM, 0x2000);
+}
+
+void RAMSearch::Start(const NES& nes)
+{
+    Capture(nes, previous);
+    candidates.assign(previous.size() / 64, ~0ull);
+}
+
+void RAMSearch::Filter(const NES& nes, RAMSearchCompare compare, uint8_t value)
+{
+    Capture(nes, current);
+    if(current.size() != previous.size())
+        return Start(nes);
+
+    for(size_t block=0; block<candidates.size(); block++)
+    {
+        //most of memory drops out after the first few steps
+        if(candidates[block])
+            candidates[block] &= CompareBlock(current.data() + block * 64, previous.data() + block * 64, compare, value);
+    }
+    std::swap(previous, current);
+}
+
+size_t RAMSearch::Count() const
+{
+    size_t count = 0;
+    for(uint64_t block : candidates)
+        count += __builtin_popcountll(block);
+    return count;
+}
+
+std::vector<std::pair<uint16_t, uint8_t>> RAMSearch::Candidates(size_t maxCount) const
+{
+    std::vector<std::pair<uint16_t, uint8_t>> result;
+    for(size_t block=0; block<candidates.size() && result.size() < maxCount; block++)
+    {
+        for(uint64_t bits = candidates[block]; bits && result.size() < maxCount; bits &= bits - 1)
+        {
+            size_t index = block * 64 + __builtin_ctzll(bits);
+            result.emplace_back(ToAddress(index), previous[index]);
+        }
+    }
+    return result;
+}
+
+int RAMSearch::ToIndex(uint16_t address)
+{
+    if(address < 0x2000)
+        return address % 0x800;
+    if(address >= 0x6000 && address < 0x8000)
+        return 0x800 + address - 0x6000;
+    return -1;
+}
+
+void RAMSearch::Watch(uint16_t address, uint8_t value)
+{
+    if(ToIndex(address) >= 0)
+        watches.push_back(WatchedAddress{address, value});
+}
+
+std::vector<std::tuple<uint16_t, uint8_t, uint8_t>> RAMSearch::CheckWatches(const NES& nes)
+{
+    std::vector<std::tuple<uint16_t, uint8_t, uint8_t>> changes;
+    const uint8_t* saveRAM = nes.GetSaveRAM();
+    for(WatchedAddress& watch : watches)
+    {
+        int index = ToIndex(watch.address);
+        if(index >= 0x800 && !saveRAM)
+            continue;
+        uint8_t value = index < 0x800 ? nes.GetRAM()[index] : saveRAM[index - 0x800];
+        if(value != watch.value)
+            changes.emplace_back(watch.address, watch.value, value);
+        watch.value = value;
+    }
+    return changes;
+}
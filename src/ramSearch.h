@@ -0,0 +1,56 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <utility>
+#include <tuple>
+
+class NES;
+
+enum RAMSearchCompare
+{
+    SEARCH_EQUAL, //same as at the last search step
+    SEARCH_NOT_EQUAL,
+    SEARCH_GREATER, //unsigned, compared to the last search step
+    SEARCH_LESS,
+    SEARCH_DELTA, //changed by exactly value since the last search step, wrapping around
+    SEARCH_VALUE //currently holds value
+};
+
+//narrows down where a game keeps a variable by repeatedly comparing work RAM and cartridge RAM against the previous step.
+//candidates are kept as one bit per byte and filtered 64 bytes at a time with SIMD compares
+class RAMSearch
+{
+public:
+    //every byte becomes a candidate again
+    void Start(const NES& nes);
+    //keeps the candidates passing the comparison and remembers the current values for the next step
+    void Filter(const NES& nes, RAMSearchCompare compare, uint8_t value = 0);
+
+    size_t Count() const;
+    //CPU addresses of the remaining candidates, $0000-$07FF for work RAM and $6000-$7FFF for cartridge RAM, with their current values
+    std::vector<std::pair<uint16_t, uint8_t>> Candidates(size_t maxCount = SIZE_MAX) const;
+
+    //watched addresses are reported by CheckWatches whenever their value changes from value, the one it has now
+    void Watch(uint16_t address, uint8_t value);
+    void ClearWatches() { watches.clear(); }
+    //address, old value and new value of every watch that changed since the last call
+    std::vector<std::tuple<uint16_t, uint8_t, uint8_t>> CheckWatches(const NES& nes);
+
+private:
+    void Capture(const NES& nes, std::vector<uint8_t>& memory) const;
+    static uint16_t ToAddress(size_t index) { return index < 0x800 ? index : 0x6000 + index - 0x800; }
+    static int ToIndex(uint16_t address);
+
+    std::vector<uint8_t> previous;
+    std::vector<uint8_t> current;
+    //one bit per byte of previous
+    std::vector<uint64_t> candidates;
+
+    struct WatchedAddress
+    {
+        uint16_t address;
+        uint8_t value;
+    };
+    std::vector<WatchedAddress> watches;
+};
@@ -0,0 +1,62 @@
+#pragma once
+#include <cstdint>
+
+//everything that differs between NTSC and PAL consoles. the scanline, audio and DMC paths are templated on these
+//so region checks and clock rate divisions fold into constants, with one instantiation per region
+struct NTSC
+{
+    static constexpr double CPUclockRate = 1789773.0;
+    static constexpr int framesPerSecond = 60;
+    static constexpr float msPerFrame = 16.66666f;
+
+    static constexpr int numTotalLines = 262;
+    static constexpr int numVBlankLines = 30;
+    static constexpr int firstVBlankLine = numTotalLines - numVBlankLines;
+    //the top 8 lines are cut off, they still run but the picture starts at line 8 and is only 224 lines high
+    static constexpr int firstVisibleLine = 8;
+    static constexpr int visibleLines = 224;
+
+    //the frame sequencer steps every 65.5 scanlines
+    static constexpr int APUframeStepHalfLines = 131;
+    static constexpr double CPUcyclesPerAPUStep = CPUclockRate / (framesPerSecond * 4);
+    //samples mixed per frame sequencer step
+    static constexpr int samplesPerAPUStep = 12000 / framesPerSecond;
+    //a frame of all 262 lines is 4 steps, so every frame mixes a 60th of a second of audio
+    static constexpr int samplesPerFrame = samplesPerAPUStep * numTotalLines * 2 / APUframeStepHalfLines;
+
+    //3 master clock cycles per CPU cycle
+    static constexpr uint64_t ToCPUcycles(uint64_t PPUcycles) { return PPUcycles / 3; }
+    static constexpr uint64_t ToPPUcycles(uint64_t CPUcycles) { return CPUcycles * 3; }
+
+    static constexpr uint16_t noisePeriods[16] = {4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068};
+    static constexpr uint16_t DMCrates[16] = {428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106, 84, 72, 54};
+};
+
+struct PAL
+{
+    static constexpr double CPUclockRate = 1662607.0;
+    static constexpr int framesPerSecond = 50;
+    static constexpr float msPerFrame = 20.0f;
+
+    static constexpr int numTotalLines = 312;
+    static constexpr int numVBlankLines = 72;
+    static constexpr int firstVBlankLine = numTotalLines - numVBlankLines;
+    static constexpr int firstVisibleLine = 0;
+    static constexpr int visibleLines = 240;
+
+    //every 78 scanlines
+    static constexpr int APUframeStepHalfLines = 156;
+    static constexpr double CPUcyclesPerAPUStep = CPUclockRate / (framesPerSecond * 4);
+    static constexpr int samplesPerAPUStep = 12000 / framesPerSecond;
+    static constexpr int samplesPerFrame = samplesPerAPUStep * numTotalLines * 2 / APUframeStepHalfLines;
+
+    //3.2 master clock cycles per CPU cycle
+    static constexpr uint64_t ToCPUcycles(uint64_t PPUcycles) { return PPUcycles * 5 / 16; }
+    static constexpr uint64_t ToPPUcycles(uint64_t CPUcycles) { return CPUcycles * 16 / 5; }
+
+    static constexpr uint16_t noisePeriods[16] = {4, 8, 14, 30, 60, 88, 118, 148, 188, 236, 354, 472, 708, 944, 1890, 1890};
+    static constexpr uint16_t DMCrates[16] = {398, 354, 316, 298, 276, 236, 210, 198, 176, 148, 132, 118, 98, 78, 66, 50};
+};
+
+//pacing and capture take a frame's audio to be exactly one frame long at 48000Hz
+static_assert(NTSC::samplesPerFrame * NTSC::framesPerSecond == 48000 && PAL::samplesPerFrame * PAL::framesPerSecond == 48000);
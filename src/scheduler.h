@@ -0,0 +1,54 @@
+#pragma once
+#include <cstdint>
+
+//ties are resolved in enum order, so a scanline always ends before the APU and NMI work scheduled for the same cycle
+enum SchedulerEvent
+{
+    EVENT_SCANLINE_END,
+    EVENT_DMC_FETCH,
+    EVENT_APU_FRAME_STEP,
+    EVENT_NMI,
+    EVENT_MAPPER_IRQ, //reserved for mappers with scanline counters, nothing supported schedules it yet
+    NUM_EVENTS
+};
+
+//next event timestamps in master clock (PPU) cycles. with this few event types a linear scan is cheaper than a heap
+class Scheduler
+{
+public:
+    static constexpr uint64_t NEVER = UINT64_MAX;
+
+    void Schedule(SchedulerEvent event, uint64_t time)
+    {
+        deadlines[event] = time;
+        FindNext();
+    }
+
+    void Cancel(SchedulerEvent event)
+    {
+        deadlines[event] = NEVER;
+        FindNext();
+    }
+
+    uint64_t Deadline(SchedulerEvent event) const { return deadlines[event]; }
+    uint64_t NextDeadline() const { return nextDeadline; }
+    SchedulerEvent NextEvent() const { return nextEvent; }
+
+private:
+    void FindNext()
+    {
+        nextDeadline = NEVER;
+        for(int i=0; i<NUM_EVENTS; i++)
+        {
+            if(deadlines[i] < nextDeadline)
+            {
+                nextDeadline = deadlines[i];
+                nextEvent = (SchedulerEvent)i;
+            }
+        }
+    }
+
+    uint64_t deadlines[NUM_EVENTS] = {NEVER, NEVER, NEVER, NEVER, NEVER};
+    uint64_t nextDeadline = NEVER;
+    SchedulerEvent nextEvent = EVENT_SCANLINE_END;
+};
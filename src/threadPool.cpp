@@ -0,0 +1,100 @@
+#include "threadPool.h"
+
+using namespace std;
+
+WorkStealingPool::WorkStealingPool(int numThreads)
+{
+    numThreads = max(numThreads, 1);
+    for(int i=0; i<numThreads; i++)
+        queues.push_back(make_unique<WorkerQueue>());
+    for(int i=0; i<numThreads; i++)
+        threads.emplace_back(&WorkStealingPool::WorkerLoop, this, i);
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+    }
+    workReady.notify_all();
+    for(thread& worker : threads)
+        worker.join();
+}
+
+void WorkStealingPool::ParallelFor(size_t count, const function<void(size_t)>& task)
+{
+    if(count == 0)
+        return;
+
+    {
+        lock_guard<mutex> guard(lock);
+        currentTask = &task;
+        remaining = count;
+        for(size_t i=0; i<count; i++)
+        {
+            WorkerQueue& queue = *queues[i % queues.size()];
+            lock_guard<mutex> queueGuard(queue.lock);
+            queue.indices.push_back(i);
+        }
+        batch++;
+    }
+    workReady.notify_all();
+
+    unique_lock<mutex> guard(lock);
+    workDone.wait(guard, [&]{ return remaining == 0; });
+    currentTask = nullptr;
+}
+
+bool WorkStealingPool::TakeWork(int id, size_t& index)
+{
+    {
+        WorkerQueue& own = *queues[id];
+        lock_guard<mutex> guard(own.lock);
+        if(!own.indices.empty())
+        {
+            index = own.indices.front();
+            own.indices.pop_front();
+            return true;
+        }
+    }
+
+    for(size_t i=1; i<queues.size(); i++)
+    {
+        WorkerQueue& victim = *queues[(id + i) % queues.size()];
+        lock_guard<mutex> guard(victim.lock);
+        if(!victim.indices.empty())
+        {
+            index = victim.indices.back();
+            victim.indices.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
+
+void WorkStealingPool::WorkerLoop(int id)
+{
+    uint64_t lastBatch = 0;
+    while(true)
+    {
+        {
+            unique_lock<mutex> guard(lock);
+            workReady.wait(guard, [&]{ return stopping || batch != lastBatch; });
+            if(stopping)
+                return;
+            lastBatch = batch;
+        }
+
+        size_t index;
+        while(TakeWork(id, index))
+        {
+            (*currentTask)(index);
+            if(remaining.fetch_sub(1) == 1)
+            {
+                lock_guard<mutex> guard(lock);
+                workDone.notify_all();
+            }
+        }
+    }
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <deque>
+#include <functional>
+#include <condition_variable>
+#include <atomic>
+
+//fixed set of worker threads, each with its own queue. idle workers take work from the back of the others' queues
+//so instances that happen to run slower don't hold the whole batch up
+class WorkStealingPool
+{
+public:
+    explicit WorkStealingPool(int numThreads);
+    ~WorkStealingPool();
+
+    //calls task for every index in [0, count) across the workers and returns once all of them finished
+    void ParallelFor(size_t count, const std::function<void(size_t)>& task);
+    int NumThreads() const { return threads.size(); }
+
+private:
+    struct WorkerQueue
+    {
+        std::mutex lock;
+        std::deque<size_t> indices;
+    };
+
+    void WorkerLoop(int id);
+    bool TakeWork(int id, size_t& index);
+
+    std::vector<std::unique_ptr<WorkerQueue>> queues;
+    std::vector<std::thread> threads;
+
+    std::mutex lock;
+    std::condition_variable workReady;
+    std::condition_variable workDone;
+    const std::function<void(size_t)>* currentTask=nullptr;
+    uint64_t batch=0;
+    std::atomic<size_t> remaining{0};
+    bool stopping=false;
+};
@@ -0,0 +1,447 @@
+#include "upscale.h"
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <array>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+bool ParseUpscaleFilter(const std::string& name, UpscaleFilter& filter)
+{
+    if(name == "nearest")
+        filter = UPSCALE_NEAREST;
+    else if(name == "scale")
+        filter = UPSCALE_SCALE;
+    else if(name == "xbr")
+        filter = UPSCALE_XBR;
+    else if(name == "ntsc")
+        filter = UPSCALE_NTSC;
+    else
+        return false;
+    return true;
+}
+
+bool UpscaleFactorSupported(UpscaleFilter filter, int factor)
+{
+    switch(filter)
+    {
+    case UPSCALE_NONE:
+    case UPSCALE_NTSC:
+        return true;
+    case UPSCALE_NEAREST:
+        return factor >= 1 && factor <= 8;
+    case UPSCALE_SCALE:
+        return factor >= 2 && factor <= 4;
+    case UPSCALE_XBR:
+        return factor == 2 || factor == 4;
+    }
+    return false;
+}
+
+Upscaler::Upscaler(UpscaleFilter filter, int factor, int redShift, int numThreads)
+    : filter(filter), factor(factor), redShift(redShift), pool(numThreads)
+{
+}
+
+//every pixel of a row repeated factor times
+static void NearestRow(const uint32_t* source, int width, int factor, uint32_t* destination)
+{
+    int x = 0;
+#ifdef __SSE2__
+    if(factor == 2)
+    {
+        for(; x + 4 <= width; x += 4)
+        {
+            __m128i pixels = _mm_loadu_si128((const __m128i*)(source + x));
+            _mm_storeu_si128((__m128i*)(destination + x * 2), _mm_unpacklo_epi32(pixels, pixels));
+            _mm_storeu_si128((__m128i*)(destination + x * 2 + 4), _mm_unpackhi_epi32(pixels, pixels));
+        }
+    }
+    else if(factor == 4)
+    {
+        for(; x + 4 <= width; x += 4)
+        {
+            __m128i pixels = _mm_loadu_si128((const __m128i*)(source + x));
+            _mm_storeu_si128((__m128i*)(destination + x * 4), _mm_shuffle_epi32(pixels, 0x00));
+            _mm_storeu_si128((__m128i*)(destination + x * 4 + 4), _mm_shuffle_epi32(pixels, 0x55));
+            _mm_storeu_si128((__m128i*)(destination + x * 4 + 8), _mm_shuffle_epi32(pixels, 0xAA));
+            _mm_storeu_si128((__m128i*)(destination + x * 4 + 12), _mm_shuffle_epi32(pixels, 0xFF));
+        }
+    }
+#endif
+    for(; x < width; x++)
+        std::fill_n(destination + x * factor, factor, source[x]);
+}
+
+//the row with a copy of the edge pixel on either side, so neighbours can be read without bounds checks
+static void PadRow(const uint32_t* source, int width, int padding, uint32_t* padded)
+{
+    std::fill_n(padded, padding, source[0]);
+    memcpy(padded + padding, source, width * sizeof(uint32_t));
+    std::fill_n(padded + padding + width, padding, source[width - 1]);
+}
+
+//   B        E0 E1
+// D E F  ->  E2 E3
+//   H
+static inline void Scale2xPixel(uint32_t B, uint32_t D, uint32_t E, uint32_t F, uint32_t H, uint32_t* top, uint32_t* bottom)
+{
+    if(B != H && D != F)
+    {
+        top[0] = D == B ? D : E;
+        top[1] = B == F ? F : E;
+        bottom[0] = D == H ? D : E;
+        bottom[1] = H == F ? F : E;
+    }
+    else
+    {
+        top[0] = top[1] = bottom[0] = bottom[1] = E;
+    }
+}
+
+#ifdef __SSE2__
+static inline __m128i Select(__m128i condition, __m128i ifTrue, __m128i ifFalse)
+{
+    return _mm_or_si128(_mm_and_si128(condition, ifTrue), _mm_andnot_si128(condition, ifFalse));
+}
+#endif
+
+static void Scale2xRow(const uint32_t* above, const uint32_t* padded, const uint32_t* below, int width, uint32_t* top, uint32_t* bottom)
+{
+    const uint32_t* row = padded + 1;
+    int x = 0;
+#ifdef __SSE2__
+    //four pixels at a time. the rules all require B != H and D != F, the per corner equalities pick D, F or E
+    for(; x + 4 <= width; x += 4)
+    {
+        __m128i B = _mm_loadu_si128((const __m128i*)(above + x));
+        __m128i H = _mm_loadu_si128((const __m128i*)(below + x));
+        __m128i D = _mm_loadu_si128((const __m128i*)(row + x - 1));
+        __m128i E = _mm_loadu_si128((const __m128i*)(row + x));
+        __m128i F = _mm_loadu_si128((const __m128i*)(row + x + 1));
+
+        __m128i same = _mm_or_si128(_mm_cmpeq_epi32(B, H), _mm_cmpeq_epi32(D, F));
+        __m128i E0 = Select(_mm_andnot_si128(same, _mm_cmpeq_epi32(D, B)), D, E);
+        __m128i E1 = Select(_mm_andnot_si128(same, _mm_cmpeq_epi32(B, F)), F, E);
+        __m128i E2 = Select(_mm_andnot_si128(same, _mm_cmpeq_epi32(D, H)), D, E);
+        __m128i E3 = Select(_mm_andnot_si128(same, _mm_cmpeq_epi32(H, F)), F, E);
+
+        _mm_storeu_si128((__m128i*)(top + x * 2), _mm_unpacklo_epi32(E0, E1));
+        _mm_storeu_si128((__m128i*)(top + x * 2 + 4), _mm_unpackhi_epi32(E0, E1));
+        _mm_storeu_si128((__m128i*)(bottom + x * 2), _mm_unpacklo_epi32(E2, E3));
+        _mm_storeu_si128((__m128i*)(bottom + x * 2 + 4), _mm_unpackhi_epi32(E2, E3));
+    }
+#endif
+    for(; x < width; x++)
+        Scale2xPixel(above[x], row[x - 1], row[x], row[x + 1], below[x], top + x * 2, bottom + x * 2);
+}
+
+// A B C      E0 E1 E2
+// D E F  ->  E3 E4 E5
+// G H I      E6 E7 E8
+//three outputs per pixel don't line up with vector lanes, so this one stays scalar
+static void Scale3xRow(const uint32_t* above, const uint32_t* row, const uint32_t* below, int width, uint32_t* out0, uint32_t* out1, uint32_t* out2)
+{
+    for(int x=0; x<width; x++)
+    {
+        uint32_t A = above[x], B = above[x + 1], C = above[x + 2];
+        uint32_t D = row[x], E = row[x + 1], F = row[x + 2];
+        uint32_t G = below[x], H = below[x + 1], I = below[x + 2];
+        uint32_t* o0 = out0 + x * 3;
+        uint32_t* o1 = out1 + x * 3;
+        uint32_t* o2 = out2 + x * 3;
+        if(B != H && D != F)
+        {
+            o0[0] = D == B ? D : E;
+            o0[1] = (D == B && E != C) || (B == F && E != A) ? B : E;
+            o0[2] = B == F ? F : E;
+            o1[0] = (D == B && E != G) || (D == H && E != A) ? D : E;
+            o1[1] = E;
+            o1[2] = (B == F && E != I) || (H == F && E != C) ? F : E;
+            o2[0] = D == H ? D : E;
+            o2[1] = (D == H && E != I) || (H == F && E != G) ? H : E;
+            o2[2] = H == F ? F : E;
+        }
+        else
+        {
+            std::fill_n(o0, 3, E);
+            std::fill_n(o1, 3, E);
+            std::fill_n(o2, 3, E);
+        }
+    }
+}
+
+//xBR compares colors by a weighted distance in YUV
+struct YUV
+{
+    int y, u, v;
+};
+
+static inline YUV ToYUV(uint32_t pixel, int redShift)
+{
+    int r = (pixel >> redShift) & 0xFF;
+    int g = (pixel >> 8) & 0xFF;
+    int b = (pixel >> (16 - redShift)) & 0xFF;
+    //kept 1000 times larger, only ever compared against each other and xbrSimilar
+    return YUV{299 * r + 587 * g + 114 * b, -169 * r - 331 * g + 500 * b, 500 * r - 419 * g - 81 * b};
+}
+
+static inline int Distance(const YUV& a, const YUV& b)
+{
+    return 48 * abs(a.y - b.y) + 7 * abs(a.u - b.u) + 6 * abs(a.v - b.v);
+}
+//colours closer than this count as the same
+static constexpr int xbrSimilar = 155 * 1000;
+
+//weight/256 of source over destination, two channels at a time
+static inline uint32_t Blend(uint32_t destination, uint32_t source, uint32_t weight)
+{
+    uint32_t redBlue = ((destination & 0x00FF00FF) * (256 - weight) + (source & 0x00FF00FF) * weight) >> 8;
+    uint32_t alphaGreen = ((destination >> 8 & 0x00FF00FF) * (256 - weight) + (source >> 8 & 0x00FF00FF) * weight) >> 8;
+    return (redBlue & 0x00FF00FF) | (alphaGreen & 0x00FF00FF) << 8;
+}
+
+//the neighbours 2xBR looks at for the bottom right output of E, as (row, column) offsets.
+//the other three outputs use the same rule on the neighbourhood turned by 90 degrees each time
+enum XBRNeighbour { XBR_E, XBR_I, XBR_H, XBR_F, XBR_G, XBR_C, XBR_D, XBR_B, XBR_F4, XBR_I4, XBR_H5, XBR_I5, XBR_NEIGHBOURS };
+static constexpr int xbrOffsets[XBR_NEIGHBOURS][2] = {
+    {0, 0}, {1, 1}, {1, 0}, {0, 1}, {1, -1}, {-1, 1}, {0, -1}, {-1, 0}, {0, 2}, {1, 2}, {2, 0}, {2, 1}
+};
+
+struct XBRCorner
+{
+    std::array<std::array<int, 2>, XBR_NEIGHBOURS> offsets;
+    //the output in the corner's direction and the ones next to it along the H and F sides, as 2x2 block indices
+    int corner, besideH, besideF;
+};
+
+static constexpr std::array<XBRCorner, 4> xbrCorners = []
+{
+    auto quadrant = [](int row, int column) { return (row > 0) * 2 + (column > 0); };
+    std::array<XBRCorner, 4> corners{};
+    for(int turn=0; turn<4; turn++)
+    {
+        XBRCorner& corner = corners[turn];
+        //turning (row, column) to (-column, row) moves the bottom right corner to the top right
+        auto rotate = [turn](int row, int column)
+        {
+            for(int i=0; i<turn; i++)
+            {
+                int previousRow = row;
+                row = -column;
+                column = previousRow;
+            }
+            return std::array<int, 2>{row, column};
+        };
+        for(int i=0; i<XBR_NEIGHBOURS; i++)
+            corner.offsets[i] = rotate(xbrOffsets[i][0], xbrOffsets[i][1]);
+        auto out = rotate(1, 1);
+        corner.corner = quadrant(out[0], out[1]);
+        out = rotate(1, -1);
+        corner.besideH = quadrant(out[0], out[1]);
+        out = rotate(-1, 1);
+        corner.besideF = quadrant(out[0], out[1]);
+    }
+    return corners;
+}();
+
+//the neighbour pairs 2xBR compares. all of them are next to each other, so their distances are worked out once per
+//source pixel for the four directions instead of again for every corner of every pixel that looks at them
+enum XBRPair { XBR_EC, XBR_EG, XBR_IH5, XBR_IF4, XBR_HF, XBR_HD, XBR_HI5, XBR_FI4, XBR_FB, XBR_EI, XBR_EF, XBR_EH, XBR_PAIRS };
+static constexpr XBRNeighbour xbrPairs[XBR_PAIRS][2] = {
+    {XBR_E, XBR_C}, {XBR_E, XBR_G}, {XBR_I, XBR_H5}, {XBR_I, XBR_F4}, {XBR_H, XBR_F}, {XBR_H, XBR_D},
+    {XBR_H, XBR_I5}, {XBR_F, XBR_I4}, {XBR_F, XBR_B}, {XBR_E, XBR_I}, {XBR_E, XBR_F}, {XBR_E, XBR_H}
+};
+//distance from a pixel to the one right of it, below it, below and right, and below and left
+enum XBRDirection { XBR_RIGHT, XBR_DOWN, XBR_DOWN_RIGHT, XBR_DOWN_LEFT, XBR_DIRECTIONS };
+
+//where everything a corner looks at sits relative to E: colours in the band's padded rows and pair distances in the
+//direction planes that follow each other in one array
+struct XBRLookup
+{
+    int colors[4][XBR_NEIGHBOURS];
+    int distances[4][XBR_PAIRS];
+};
+
+static XBRLookup MakeXBRLookup(int stride, int planeSize)
+{
+    XBRLookup lookup;
+    for(int turn=0; turn<4; turn++)
+    {
+        const auto& offsets = xbrCorners[turn].offsets;
+        for(int n=0; n<XBR_NEIGHBOURS; n++)
+            lookup.colors[turn][n] = offsets[n][0] * stride + offsets[n][1];
+        for(int pair=0; pair<XBR_PAIRS; pair++)
+        {
+            auto a = offsets[xbrPairs[pair][0]];
+            auto b = offsets[xbrPairs[pair][1]];
+            //stored at the upper one of the two, or the left one when they're on the same row
+            if(b[0] < a[0] || (b[0] == a[0] && b[1] < a[1]))
+                std::swap(a, b);
+            int direction = b[0] == a[0] ? XBR_RIGHT : b[1] == a[1] ? XBR_DOWN : b[1] > a[1] ? XBR_DOWN_RIGHT : XBR_DOWN_LEFT;
+            lookup.distances[turn][pair] = direction * planeSize + a[0] * stride + a[1];
+        }
+    }
+    return lookup;
+}
+
+//Hyllian's 2xBR. decides per corner whether an edge runs through it and blends the colour across the edge in
+static std::array<uint32_t, 4> XBRPixel(const uint32_t* colors, const YUV* yuvs, const int* distances, const XBRLookup& lookup)
+{
+    uint32_t E = colors[0];
+    std::array<uint32_t, 4> block;
+    block.fill(E);
+    for(int turn=0; turn<4; turn++)
+    {
+        const XBRCorner& corner = xbrCorners[turn];
+        auto color = [&](XBRNeighbour n) { return colors[lookup.colors[turn][n]]; };
+        //no edge through a corner when E continues to either side of it, which is most of a typical frame
+        if(E == color(XBR_H) || E == color(XBR_F))
+            continue;
+        auto d = [&](XBRPair pair) { return distances[lookup.distances[turn][pair]]; };
+        auto eq = [&](XBRPair pair) { return d(pair) < xbrSimilar; };
+
+        int e = d(XBR_EC) + d(XBR_EG) + d(XBR_IH5) + d(XBR_IF4) + (d(XBR_HF) << 2);
+        int i = d(XBR_HD) + d(XBR_HI5) + d(XBR_FI4) + d(XBR_FB) + (d(XBR_EI) << 2);
+        if(e > i)
+            continue;
+        uint32_t closer = d(XBR_EF) <= d(XBR_EH) ? color(XBR_F) : color(XBR_H);
+        if(e < i && ((!eq(XBR_FB) && !eq(XBR_HD)) || (eq(XBR_EI) && !eq(XBR_FI4) && !eq(XBR_HI5)) || eq(XBR_EG) || eq(XBR_EC)))
+        {
+            const YUV* center = yuvs;
+            int ke = Distance(center[lookup.colors[turn][XBR_F]], center[lookup.colors[turn][XBR_G]]);
+            int ki = Distance(center[lookup.colors[turn][XBR_H]], center[lookup.colors[turn][XBR_C]]);
+            bool ex2 = E != color(XBR_C) && color(XBR_B) != color(XBR_C);
+            bool ex3 = E != color(XBR_G) && color(XBR_D) != color(XBR_G);
+            bool shallow = (ke << 1) <= ki && ex3;
+            bool steep = ke >= (ki << 1) && ex2;
+            if(shallow && steep)
+            {
+                block[corner.corner] = Blend(block[corner.corner], closer, 224);
+                block[corner.besideH] = Blend(block[corner.besideH], closer, 64);
+                block[corner.besideF] = block[corner.besideH];
+            }
+            else if(shallow)
+            {
+                block[corner.corner] = Blend(block[corner.corner], closer, 192);
+                block[corner.besideH] = Blend(block[corner.besideH], closer, 64);
+            }
+            else if(steep)
+            {
+                block[corner.corner] = Blend(block[corner.corner], closer, 192);
+                block[corner.besideF] = Blend(block[corner.besideF], closer, 64);
+            }
+            else
+                block[corner.corner] = Blend(block[corner.corner], closer, 128);
+        }
+        else
+            block[corner.corner] = Blend(block[corner.corner], closer, 64);
+    }
+    return block;
+}
+
+static void XBRRows(const uint32_t* source, int width, int height, int redShift, uint32_t* destination, int pitch, int firstRow, int lastRow)
+{
+    //the band's rows and two more on every side, with colours converted and neighbour distances taken once up front
+    int stride = width + 4;
+    int rows = lastRow - firstRow + 4;
+    int planeSize = stride * rows;
+    std::vector<uint32_t> colors(planeSize);
+    std::vector<YUV> yuvs(planeSize);
+    std::vector<int> distances(planeSize * XBR_DIRECTIONS);
+    for(int row=0; row<rows; row++)
+    {
+        int sourceRow = std::clamp(firstRow + row - 2, 0, height - 1);
+        PadRow(source + sourceRow * width, width, 2, colors.data() + row * stride);
+    }
+    //runs of one colour are common, so the previous conversion is reused for them
+    yuvs[0] = ToYUV(colors[0], redShift);
+    for(int i=1; i<planeSize; i++)
+        yuvs[i] = colors[i] == colors[i - 1] ? yuvs[i - 1] : ToYUV(colors[i], redShift);
+    //the last row and the edge columns have no neighbour in some directions, nothing reads those
+    auto distance = [&](int a, int b) { return colors[a] == colors[b] ? 0 : Distance(yuvs[a], yuvs[b]); };
+    for(int i=0; i + stride + 1 < planeSize; i++)
+    {
+        distances[XBR_RIGHT * planeSize + i] = distance(i, i + 1);
+        distances[XBR_DOWN * planeSize + i] = distance(i, i + stride);
+        distances[XBR_DOWN_RIGHT * planeSize + i] = distance(i, i + stride + 1);
+        distances[XBR_DOWN_LEFT * planeSize + i] = distance(i, i + stride - 1);
+    }
+
+    XBRLookup lookup = MakeXBRLookup(stride, planeSize);
+    for(int y=firstRow; y<lastRow; y++)
+    {
+        int center = (y - firstRow + 2) * stride + 2;
+        uint32_t* top = destination + y * 2 * pitch;
+        uint32_t* bottom = top + pitch;
+        for(int x=0; x<width; x++)
+        {
+            auto block = XBRPixel(colors.data() + center + x, yuvs.data() + center + x, distances.data() + center + x, lookup);
+            top[x * 2] = block[0];
+            top[x * 2 + 1] = block[1];
+            bottom[x * 2] = block[2];
+            bottom[x * 2 + 1] = block[3];
+        }
+    }
+}
+
+void Upscaler::Pass(int passFactor, const uint32_t* source, int width, int height, uint32_t* destination, int pitch, int firstRow, int lastRow)
+{
+    if(filter == UPSCALE_XBR)
+        return XBRRows(source, width, height, redShift, destination, pitch, firstRow, lastRow);
+
+    std::vector<uint32_t> padded[3];
+    for(auto& row : padded)
+        row.resize(width + 2);
+    for(int y=firstRow; y<lastRow; y++)
+    {
+        const uint32_t* row = source + y * width;
+        const uint32_t* above = source + std::max(y - 1, 0) * width;
+        const uint32_t* below = source + std::min(y + 1, height - 1) * width;
+        uint32_t* out = destination + y * passFactor * pitch;
+        if(filter == UPSCALE_NEAREST)
+        {
+            NearestRow(row, width, passFactor, out);
+            for(int i=1; i<passFactor; i++)
+                memcpy(out + i * pitch, out, width * passFactor * sizeof(uint32_t));
+        }
+        else if(passFactor == 2)
+        {
+            PadRow(row, width, 1, padded[1].data());
+            Scale2xRow(above, padded[1].data(), below, width, out, out + pitch);
+        }
+        else
+        {
+            PadRow(above, width, 1, padded[0].data());
+            PadRow(row, width, 1, padded[1].data());
+            PadRow(below, width, 1, padded[2].data());
+            Scale3xRow(padded[0].data(), padded[1].data(), padded[2].data(), width, out, out + pitch, out + pitch * 2);
+        }
+    }
+}
+
+void Upscaler::Run(const uint32_t* source, int width, int height, uint32_t* destination, int pitch)
+{
+    //a few bands per thread so the stealing evens out bands with more edges
+    auto parallelPass = [&](int passFactor, const uint32_t* in, int inWidth, int inHeight, uint32_t* out, int outPitch)
+    {
+        size_t bands = std::min<size_t>(inHeight, pool.NumThreads() * 4);
+        pool.ParallelFor(bands, [&](size_t band)
+        {
+            int first = inHeight * band / bands;
+            int last = inHeight * (band + 1) / bands;
+            Pass(passFactor, in, inWidth, inHeight, out, outPitch, first, last);
+        });
+    };
+
+    //4x for the edge detecting filters is 2x applied twice
+    if(factor == 4 && filter != UPSCALE_NEAREST)
+    {
+        intermediate.resize(width * 2 * height * 2);
+        parallelPass(2, source, width, height, intermediate.data(), width * 2);
+        parallelPass(2, intermediate.data(), width * 2, height * 2, destination, pitch);
+    }
+    else
+        parallelPass(factor, source, width, height, destination, pitch);
+}
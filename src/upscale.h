@@ -0,0 +1,43 @@
+#pragma once
+#include "threadPool.h"
+#include <cstdint>
+#include <vector>
+#include <string>
+
+enum UpscaleFilter
+{
+    UPSCALE_NONE, //the renderer stretches the frame itself
+    UPSCALE_NEAREST, //integer factors, pixels repeated
+    UPSCALE_SCALE, //Scale2x, Scale3x, or Scale2x twice for 4x
+    UPSCALE_XBR, //2xBR, or 2xBR twice for 4x
+    UPSCALE_NTSC //composite video decoded at twice the width, see NTSCFilter. the factor doesn't apply
+};
+
+//parses nearest, scale, xbr or ntsc. false for anything else
+bool ParseUpscaleFilter(const std::string& name, UpscaleFilter& filter);
+//whether the filter can produce the factor
+bool UpscaleFactorSupported(UpscaleFilter filter, int factor);
+
+//software upscaling of finished frames. the source is cut into horizontal bands that the workers scale in parallel,
+//each band only reading the source rows around it and writing its own output rows
+class Upscaler
+{
+public:
+    //redShift is where the red channel sits in a pixel, 16 for ARGB8888 and 0 for RGBA32. only xBR looks at colors
+    Upscaler(UpscaleFilter filter, int factor, int redShift, int numThreads);
+
+    int Factor() const { return factor; }
+    //width by height pixels from source into destination, which is factor times larger with lines pitch pixels apart
+    void Run(const uint32_t* source, int width, int height, uint32_t* destination, int pitch);
+
+private:
+    //one pass over source rows [firstRow, lastRow)
+    void Pass(int passFactor, const uint32_t* source, int width, int height, uint32_t* destination, int pitch, int firstRow, int lastRow);
+
+    UpscaleFilter filter;
+    int factor;
+    int redShift;
+    WorkStealingPool pool;
+    //2x result of the first of two passes
+    std::vector<uint32_t> intermediate;
+};
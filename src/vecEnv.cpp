@@ -0,0 +1,93 @@
+#include "vecEnv.h"
+#include <cstring>
+
+using namespace std;
+
+VectorEnv::VectorEnv(const string& romPath, size_t numEnvs, int numThreads, NESOptions options) : farm(numThreads)
+{
+    compact = options.observationFormat != OBSERVATION_RGBA;
+    for(size_t i=0; i<numEnvs; i++)
+    {
+        farm.Add(romPath, options);
+        startStates.push_back(farm.Instance(i).Fork());
+    }
+    if(numEnvs > 0)
+    {
+        NES& first = farm.Instance(0);
+        observationWidth = compact ? first.GetObservationWidth() : 256;
+        observationHeight = compact ? first.GetObservationHeight() : first.GetFrameHeight();
+    }
+    episodeSteps.resize(numEnvs, 0);
+    needsReset.resize(numEnvs, 0);
+}
+
+void VectorEnv::SaveStartState(size_t env)
+{
+    startStates[env] = farm.Instance(env).Fork();
+}
+
+void VectorEnv::ResetEnv(size_t env)
+{
+    farm.Instance(env).RestoreState(*startStates[env]);
+    episodeSteps[env] = 0;
+    needsReset[env] = 0;
+}
+
+void VectorEnv::WriteObservation(size_t env, uint32_t* observations, uint8_t* RAM)
+{
+    NES& nes = farm.Instance(env);
+    size_t observationSize = ObservationSize();
+    if(observations)
+        memcpy(observations + env * observationSize, nes.GetFramebuffer(), observationSize * sizeof(uint32_t));
+    if(RAM)
+        memcpy(RAM + env * RAMSize, nes.GetRAM(), RAMSize);
+}
+
+void VectorEnv::WriteObservation(size_t env, uint8_t* observations, uint8_t* RAM)
+{
+    NES& nes = farm.Instance(env);
+    if(observations)
+        nes.GetObservation(observations + env * ObservationSize());
+    if(RAM)
+        memcpy(RAM + env * RAMSize, nes.GetRAM(), RAMSize);
+}
+
+template<typename Pixel>
+void VectorEnv::ResetAll(Pixel* observations, uint8_t* RAM)
+{
+    farm.ForEach([&](size_t env, NES&)
+    {
+        ResetEnv(env);
+        WriteObservation(env, observations, RAM);
+    });
+}
+
+template<typename Pixel>
+void VectorEnv::StepAll(const uint8_t* actions, Pixel* observations, uint8_t* RAM, uint8_t* done)
+{
+    farm.ForEach([&](size_t env, NES& nes)
+    {
+        if(needsReset[env])
+        {
+            ResetEnv(env);
+            WriteObservation(env, observations, RAM);
+            done[env] = 0;
+            return;
+        }
+
+        nes.SetControllerState(0, actions[env]);
+        for(int i=0; i<frameSkip; i++)
+            nes.RunFrame();
+        episodeSteps[env]++;
+
+        WriteObservation(env, observations, RAM);
+        bool finished = (episodeLength > 0 && episodeSteps[env] >= episodeLength) || (gameOverTest && gameOverTest(nes.GetRAM()));
+        done[env] = finished;
+        needsReset[env] = finished;
+    });
+}
+
+template void VectorEnv::ResetAll(uint32_t*, uint8_t*);
+template void VectorEnv::ResetAll(uint8_t*, uint8_t*);
+template void VectorEnv::StepAll(const uint8_t*, uint32_t*, uint8_t*, uint8_t*);
+template void VectorEnv::StepAll(const uint8_t*, uint8_t*, uint8_t*, uint8_t*);
@@ -0,0 +1,59 @@
+#pragma once
+#include "farm.h"
+
+//batch interface for training agents, in the style of the Arcade Learning Environment. N headless consoles are stepped
+//together and write their observations straight into buffers the caller owns, one env after the other
+class VectorEnv
+{
+public:
+    VectorEnv(const std::string& romPath, size_t numEnvs, int numThreads = std::thread::hardware_concurrency(), NESOptions options = NESOptions());
+
+    size_t Size() const { return farm.Size(); }
+    //32-bit framebuffer pixels, or bytes with one of the 8-bit observation formats in the options
+    bool CompactObservations() const { return compact; }
+    int ObservationWidth() const { return observationWidth; }
+    int ObservationHeight() const { return observationHeight; }
+    //pixels per env in the observation buffer
+    size_t ObservationSize() const { return (size_t)observationWidth * observationHeight; }
+    //bytes per env in the RAM buffer
+    static constexpr size_t RAMSize = 0x800;
+
+    //frames run per step, with the same buttons held
+    void SetFrameSkip(int frames) { frameSkip = frames; }
+    //episodes end after this many steps, 0 for no limit
+    void SetEpisodeLength(int steps) { episodeLength = steps; }
+    //episodes also end once this returns true for an env's RAM. called from the worker threads
+    void SetGameOverTest(std::function<bool(const uint8_t* RAM)> test) { gameOverTest = std::move(test); }
+
+    //makes the current state of an env the state its following episodes start from
+    void SaveStartState(size_t env);
+
+    //restores every env to its start state and writes the first observations
+    void Reset(uint32_t* observations, uint8_t* RAM) { ResetAll(observations, RAM); }
+    void Reset(uint8_t* observations, uint8_t* RAM) { ResetAll(observations, RAM); }
+
+    //actions has one byte of buttons per env, in SetControllerState's layout. observations is Size() * ObservationSize()
+    //pixels, RAM is Size() * RAMSize bytes and done is Size() bytes, either of the first two may be null.
+    //an env that reported done is reset on the next step instead of running, and writes the first observation of its new episode
+    //the uint8_t overloads are for the 8-bit observation formats
+    void Step(const uint8_t* actions, uint32_t* observations, uint8_t* RAM, uint8_t* done) { StepAll(actions, observations, RAM, done); }
+    void Step(const uint8_t* actions, uint8_t* observations, uint8_t* RAM, uint8_t* done) { StepAll(actions, observations, RAM, done); }
+
+private:
+    template<typename Pixel> void ResetAll(Pixel* observations, uint8_t* RAM);
+    template<typename Pixel> void StepAll(const uint8_t* actions, Pixel* observations, uint8_t* RAM, uint8_t* done);
+    void ResetEnv(size_t env);
+    void WriteObservation(size_t env, uint32_t* observations, uint8_t* RAM);
+    void WriteObservation(size_t env, uint8_t* observations, uint8_t* RAM);
+
+    NESFarm farm;
+    std::vector<std::unique_ptr<NES>> startStates;
+    std::vector<int> episodeSteps;
+    std::vector<uint8_t> needsReset;
+    int frameSkip=1;
+    int episodeLength=0;
+    bool compact;
+    //the same for every env. read once here, the workers would otherwise race with env 0 restoring its state
+    int observationWidth=0, observationHeight=0;
+    std::function<bool(const uint8_t*)> gameOverTest;
+};
@@ -0,0 +1,457 @@
+//ahead of time recompiler for NROM games. traces the code reachable from the interrupt vectors and writes
+//one C++ function per block, built together with the emulator and picked up by PRG hash at load time
+//
+//build: g++ -std=c++17 -O2 tools/nesrecomp.cpp -o nesrecomp
+//usage: nesrecomp game.nes [src/aot/game.cpp]
+#include "../src/opcodes.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <filesystem>
+#include <map>
+#include <set>
+#include <vector>
+#include <string>
+#include <cstring>
+
+using namespace std;
+
+enum AddressMode { IMP, ACC, IMM, ZP, ZPX, ZPY, ABS, ABX, ABY, IZX, IZY };
+
+struct OpcodeTemplate
+{
+    uint8_t opcode;
+    AddressMode mode;
+    //$V is replaced with the value/address pair GetOperandAddressValue would return, $A with the address
+    const char* statement;
+};
+
+//mirrors NES::ExecuteStep. control flow opcodes are emitted separately, anything missing is left to the interpreter
+static const OpcodeTemplate templates[] = {
+    {0x01, IZX, "n.or6502($V.first)"},
+    {0x05, ZP, "n.or6502($V.first)"},
+    {0x06, ZP, "n.shift6502(true, false, false, $V)"},
+    {0x08, IMP, "n.PushStack8Bit(n.GetProcessorStatus() | 0b00110000)"},
+    {0x09, IMM, "n.or6502($V.first)"},
+    {0x0A, ACC, "n.shift6502(true, false, true, $V)"},
+    {0x0D, ABS, "n.or6502($V.first)"},
+    {0x0E, ABS, "n.shift6502(true, false, false, $V)"},
+    {0x11, IZY, "n.or6502($V.first)"},
+    {0x15, ZPX, "n.or6502($V.first)"},
+    {0x16, ZPX, "n.shift6502(true, false, false, $V)"},
+    {0x18, IMP, "n.SetProcessorStatusFlag(NES::CARRY, false)"},
+    {0x19, ABY, "n.or6502($V.first)"},
+    {0x1D, ABX, "n.or6502($V.first)"},
+    {0x1E, ABX, "n.shift6502(true, false, false, $V)"},
+    {0x21, IZX, "n.and6502($V.first)"},
+    {0x24, ZP, "n.bit6502($V.first)"},
+    {0x25, ZP, "n.and6502($V.first)"},
+    {0x26, ZP, "n.shift6502(true, true, false, $V)"},
+    {0x28, IMP, "n.SetProcessorStatus(n.PullStack8Bit() & 0b11001111)"},
+    {0x29, IMM, "n.and6502($V.first)"},
+    {0x2A, ACC, "n.shift6502(true, true, true, $V)"},
+    {0x2C, ABS, "n.bit6502($V.first)"},
+    {0x2D, ABS, "n.and6502($V.first)"},
+    {0x2E, ABS, "n.shift6502(true, true, false, $V)"},
+    {0x31, IZY, "n.and6502($V.first)"},
+    {0x35, ZPX, "n.and6502($V.first)"},
+    {0x36, ZPX, "n.shift6502(true, true, false, $V)"},
+    {0x38, IMP, "n.SetProcessorStatusFlag(NES::CARRY, true)"},
+    {0x39, ABY, "n.and6502($V.first)"},
+    {0x3D, ABX, "n.and6502($V.first)"},
+    {0x3E, ABX, "n.shift6502(true, true, false, $V)"},
+    {0x41, IZX, "n.eor6502($V.first)"},
+    {0x45, ZP, "n.eor6502($V.first)"},
+    {0x46, ZP, "n.shift6502(false, false, false, $V)"},
+    {0x48, IMP, "n.PushStack8Bit(n.registers.accumulator)"},
+    {0x49, IMM, "n.eor6502($V.first)"},
+    {0x4A, ACC, "n.shift6502(false, false, true, $V)"},
+    {0x4D, ABS, "n.eor6502($V.first)"},
+    {0x4E, ABS, "n.shift6502(false, false, false, $V)"},
+    {0x51, IZY, "n.eor6502($V.first)"},
+    {0x55, ZPX, "n.eor6502($V.first)"},
+    {0x56, ZPX, "n.shift6502(false, false, false, $V)"},
+    {0x58, IMP, "n.SetProcessorStatusFlag(NES::INTERRUPT_DISABLE, false)"},
+    {0x59, ABY, "n.eor6502($V.first)"},
+    {0x5D, ABX, "n.eor6502($V.first)"},
+    {0x5E, ABX, "n.shift6502(false, false, false, $V)"},
+    {0x61, IZX, "n.add6502($V.first)"},
+    {0x65, ZP, "n.add6502($V.first)"},
+    {0x66, ZP, "n.shift6502(false, true, false, $V)"},
+    {0x68, IMP, "n.registers.accumulator = n.PullStack8Bit(); n.UpdateZeroAndNegativeFlags(n.registers.accumulator)"},
+    {0x69, IMM, "n.add6502($V.first)"},
+    {0x6A, ACC, "n.shift6502(false, true, true, $V)"},
+    {0x6D, ABS, "n.add6502($V.first)"},
+    {0x6E, ABS, "n.shift6502(false, true, false, $V)"},
+    {0x71, IZY, "n.add6502($V.first)"},
+    {0x75, ZPX, "n.add6502($V.first)"},
+    {0x76, ZPX, "n.shift6502(false, true, false, $V)"},
+    {0x78, IMP, "n.SetProcessorStatusFlag(NES::INTERRUPT_DISABLE, true)"},
+    {0x79, ABY, "n.add6502($V.first)"},
+    {0x7D, ABX, "n.add6502($V.first)"},
+    {0x7E, ABX, "n.shift6502(false, true, false, $V)"},
+    {0x81, IZX, "n.store6502($A, n.registers.accumulator)"},
+    {0x84, ZP, "n.store6502($A, n.registers.Yregister)"},
+    {0x85, ZP, "n.store6502($A, n.registers.accumulator)"},
+    {0x86, ZP, "n.store6502($A, n.registers.Xregister)"},
+    {0x88, IMP, "n.inc6502(n.registers.Yregister, true)"},
+    {0x8A, IMP, "n.transfer6502(n.registers.Xregister, n.registers.accumulator,true)"},
+    {0x8C, ABS, "n.store6502($A, n.registers.Yregister)"},
+    {0x8D, ABS, "n.store6502($A, n.registers.accumulator)"},
+    {0x8E, ABS, "n.store6502($A, n.registers.Xregister)"},
+    {0x91, IZY, "n.store6502($A, n.registers.accumulator)"},
+    {0x94, ZPX, "n.store6502($A, n.registers.Yregister)"},
+    {0x95, ZPX, "n.store6502($A, n.registers.accumulator)"},
+    {0x96, ZPY, "n.store6502($A, n.registers.Xregister)"},
+    {0x98, IMP, "n.transfer6502(n.registers.Yregister, n.registers.accumulator,true)"},
+    {0x99, ABY, "n.store6502($A, n.registers.accumulator)"},
+    {0x9A, IMP, "n.transfer6502(n.registers.Xregister, n.registers.stackPointer, false)"},
+    {0x9D, ABX, "n.store6502($A, n.registers.accumulator)"},
+    {0xA0, IMM, "n.load6502($V.first, n.registers.Yregister)"},
+    {0xA1, IZX, "n.load6502($V.first, n.registers.accumulator)"},
+    {0xA2, IMM, "n.load6502($V.first, n.registers.Xregister)"},
+    {0xA4, ZP, "n.load6502($V.first, n.registers.Yregister)"},
+    {0xA5, ZP, "n.load6502($V.first, n.registers.accumulator)"},
+    {0xA6, ZP, "n.load6502($V.first, n.registers.Xregister)"},
+    {0xA8, IMP, "n.transfer6502(n.registers.accumulator, n.registers.Yregister,true)"},
+    {0xA9, IMM, "n.load6502($V.first, n.registers.accumulator)"},
+    {0xAA, IMP, "n.transfer6502(n.registers.accumulator, n.registers.Xregister,true)"},
+    {0xAC, ABS, "n.load6502($V.first, n.registers.Yregister)"},
+    {0xAD, ABS, "n.load6502($V.first, n.registers.accumulator)"},
+    {0xAE, ABS, "n.load6502($V.first, n.registers.Xregister)"},
+    {0xB1, IZY, "n.load6502($V.first, n.registers.accumulator)"},
+    {0xB4, ZPX, "n.load6502($V.first, n.registers.Yregister)"},
+    {0xB5, ZPX, "n.load6502($V.first, n.registers.accumulator)"},
+    {0xB6, ZPY, "n.load6502($V.first, n.registers.Xregister)"},
+    {0xB8, IMP, "n.SetProcessorStatusFlag(NES::OVERFLOW, false)"},
+    {0xB9, ABY, "n.load6502($V.first, n.registers.accumulator)"},
+    {0xBA, IMP, "n.transfer6502(n.registers.stackPointer, n.registers.Xregister,true)"},
+    {0xBC, ABX, "n.load6502($V.first, n.registers.Yregister)"},
+    {0xBD, ABX, "n.load6502($V.first, n.registers.accumulator)"},
+    {0xBE, ABY, "n.load6502($V.first, n.registers.Xregister)"},
+    {0xC0, IMM, "n.compare6502(n.registers.Yregister, $V.first)"},
+    {0xC1, IZX, "n.compare6502(n.registers.accumulator, $V.first)"},
+    {0xC4, ZP, "n.compare6502(n.registers.Yregister, $V.first)"},
+    {0xC5, ZP, "n.compare6502(n.registers.accumulator, $V.first)"},
+    {0xC6, ZP, "n.incMem6502($V, true)"},
+    {0xC8, IMP, "n.inc6502(n.registers.Yregister, false)"},
+    {0xC9, IMM, "n.compare6502(n.registers.accumulator, $V.first)"},
+    {0xCA, IMP, "n.inc6502(n.registers.Xregister, true)"},
+    {0xCC, ABS, "n.compare6502(n.registers.Yregister, $V.first)"},
+    {0xCD, ABS, "n.compare6502(n.registers.accumulator, $V.first)"},
+    {0xCE, ABS, "n.incMem6502($V, true)"},
+    {0xD1, IZY, "n.compare6502(n.registers.accumulator, $V.first)"},
+    {0xD5, ZPX, "n.compare6502(n.registers.accumulator, $V.first)"},
+    {0xD6, ZPX, "n.incMem6502($V, true)"},
+    {0xD8, IMP, "n.SetProcessorStatusFlag(NES::DECIMAL, false)"},
+    {0xD9, ABY, "n.compare6502(n.registers.accumulator, $V.first)"},
+    {0xDD, ABX, "n.compare6502(n.registers.accumulator, $V.first)"},
+    {0xDE, ABX, "n.incMem6502($V, true)"},
+    {0xE0, IMM, "n.compare6502(n.registers.Xregister, $V.first)"},
+    {0xE1, IZX, "n.subtract6502($V.first)"},
+    {0xE4, ZP, "n.compare6502(n.registers.Xregister, $V.first)"},
+    {0xE5, ZP, "n.subtract6502($V.first)"},
+    {0xE6, ZP, "n.incMem6502($V, false)"},
+    {0xE8, IMP, "n.inc6502(n.registers.Xregister, false)"},
+    {0xE9, IMM, "n.subtract6502($V.first)"},
+    {0xEA, IMP, ""},
+    {0xEC, ABS, "n.compare6502(n.registers.Xregister, $V.first)"},
+    {0xED, ABS, "n.subtract6502($V.first)"},
+    {0xEE, ABS, "n.incMem6502($V, false)"},
+    {0xF1, IZY, "n.subtract6502($V.first)"},
+    {0xF5, ZPX, "n.subtract6502($V.first)"},
+    {0xF6, ZPX, "n.incMem6502($V, false)"},
+    {0xF8, IMP, "n.SetProcessorStatusFlag(NES::DECIMAL, true)"},
+    {0xF9, ABY, "n.subtract6502($V.first)"},
+    {0xFD, ABX, "n.subtract6502($V.first)"},
+    {0xFE, ABX, "n.incMem6502($V, false)"},
+};
+
+struct Instruction
+{
+    uint16_t address;
+    uint8_t opcode;
+    uint8_t operand[2];
+};
+
+uint8_t PRG[0x8000];
+const OpcodeTemplate* templateTable[256];
+map<uint16_t, vector<Instruction>> blocks;
+
+uint8_t ReadPRG(uint16_t address)
+{
+    return PRG[address - 0x8000];
+}
+
+uint32_t HashPRG()
+{
+    //must match AOTCore::HashPRG
+    uint32_t hash = 2166136261u;
+    for(uint8_t byte : PRG)
+    {
+        hash ^= byte;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+void LoadROM(const string& path)
+{
+    ifstream romFile(path, ifstream::binary);
+    if(!romFile.is_open())
+    {
+        cerr << "Unable to read file " << path << '\n';
+        exit(2);
+    }
+
+    uint8_t header[16];
+    romFile.read((char*)header, 16);
+    if(memcmp(header, "NES\x1A", 4) != 0)
+    {
+        cerr << "Not an iNES file\n";
+        exit(3);
+    }
+
+    uint8_t mapperType = (header[6] >> 4) | (header[7] & 0xF0);
+    if(mapperType != 0 || (header[4] != 1 && header[4] != 2))
+    {
+        cerr << "Only NROM games can be recompiled\n";
+        exit(5);
+    }
+
+    if(header[6] & 0b100)
+        romFile.seekg(512, ios::cur);
+    romFile.read((char*)PRG, header[4] * 0x4000);
+    if(header[4] == 1)
+        memcpy(PRG + 0x4000, PRG, 0x4000);
+
+    if(romFile.fail())
+    {
+        cerr << "Rom file is truncated\n";
+        exit(4);
+    }
+}
+
+//follows every direct branch, jump and call. blocks end at the first instruction that can change the program counter
+void TraceBlocks()
+{
+    vector<uint16_t> pending;
+    for(uint16_t vectorAddress : {0xFFFA, 0xFFFC, 0xFFFE})
+        pending.push_back(ReadPRG(vectorAddress) | (ReadPRG(vectorAddress + 1) << 8));
+
+    while(!pending.empty())
+    {
+        uint16_t start = pending.back();
+        pending.pop_back();
+        if(start < 0x8000 || blocks.count(start))
+            continue;
+
+        vector<Instruction>& block = blocks[start];
+        uint32_t address = start;
+        while(address + opcodeLengths[ReadPRG(address)] <= 0x10000)
+        {
+            Instruction instruction{(uint16_t)address, ReadPRG(address), {0, 0}};
+            uint8_t length = opcodeLengths[instruction.opcode];
+            for(int i=1; i<length; i++)
+                instruction.operand[i-1] = ReadPRG(address + i);
+            block.push_back(instruction);
+
+            uint16_t next = address + length;
+            uint16_t absolute = instruction.operand[0] | (instruction.operand[1] << 8);
+            if((instruction.opcode & 0x1F) == 0x10)
+            {
+                pending.push_back(next + (int8_t)instruction.operand[0]);
+                pending.push_back(next);
+            }
+            else if(instruction.opcode == 0x4C)
+                pending.push_back(absolute);
+            else if(instruction.opcode == 0x20)
+            {
+                pending.push_back(absolute);
+                pending.push_back(next);
+            }
+
+            if(IsControlFlowOpcode(instruction.opcode) || !templateTable[instruction.opcode])
+                break;
+            address = next;
+        }
+        if(block.empty())
+            blocks.erase(start);
+    }
+}
+
+string HexDigits(int value, int digits)
+{
+    stringstream stream;
+    stream << uppercase << hex << setfill('0') << setw(digits) << value;
+    return stream.str();
+}
+
+string Hex(int value, int digits)
+{
+    return "0x" + HexDigits(value, digits);
+}
+
+string ReplaceAll(string text, const string& from, const string& to)
+{
+    for(size_t pos = text.find(from); pos != string::npos; pos = text.find(from, pos + to.size()))
+        text.replace(pos, from.size(), to);
+    return text;
+}
+
+string OperandStatement(const OpcodeTemplate& opcodeTemplate, const Instruction& instruction)
+{
+    string zeroPage = Hex(instruction.operand[0], 2);
+    uint16_t absolute = instruction.operand[0] | (instruction.operand[1] << 8);
+    string address, value;
+    switch(opcodeTemplate.mode)
+    {
+    case IMP:
+        break;
+    case ACC:
+        value = "std::pair<uint16_t, uint16_t>(n.registers.accumulator, 0)";
+        break;
+    case IMM:
+        value = "std::pair<uint16_t, uint16_t>(" + zeroPage + ", 0)";
+        break;
+    case ZP:
+        address = zeroPage;
+        break;
+    case ZPX:
+        address = "(" + zeroPage + " + n.registers.Xregister) % 256";
+        break;
+    case ZPY:
+        address = "(" + zeroPage + " + n.registers.Yregister) % 256";
+        break;
+    case ABS:
+        address = Hex(absolute, 4);
+        break;
+    case ABX:
+        address = "(uint16_t)(" + Hex(absolute, 4) + " + n.registers.Xregister)";
+        break;
+    case ABY:
+        address = "(uint16_t)(" + Hex(absolute, 4) + " + n.registers.Yregister)";
+        break;
+    case IZX:
+        address = "n.Read16BitWrapAround((" + zeroPage + " + n.registers.Xregister) % 256)";
+        break;
+    case IZY:
+        address = "(uint16_t)(n.Read16BitWrapAround(" + zeroPage + ") + n.registers.Yregister)";
+        value = "AOTCore::IndirectYValue(n, " + address + ")";
+        break;
+    }
+
+    if(value.empty() && !address.empty())
+    {
+        //plain RAM reads have no side effects and skip the memory map
+        bool isRAM = opcodeTemplate.mode == ZP || (opcodeTemplate.mode == ABS && absolute < 0x2000);
+        value = (isRAM ? "AOTCore::RAMValue(n, " : "AOTCore::Value(n, ") + address + ")";
+    }
+
+    string statement = ReplaceAll(opcodeTemplate.statement, "$V", value);
+    return ReplaceAll(statement, "$A", address);
+}
+
+void EmitBlock(ostream& out, const string& program, uint16_t start, const vector<Instruction>& block)
+{
+    static const char* branchFlags[8] = {"NEGATIVE", "NEGATIVE", "OVERFLOW", "OVERFLOW", "CARRY", "CARRY", "ZERO", "ZERO"};
+
+    out << "void " << program << "::Block" << HexDigits(start, 4) << "(NES& n)\n{\n";
+    for(size_t i=0; i<block.size(); i++)
+    {
+        const Instruction& instruction = block[i];
+        uint8_t opcode = instruction.opcode;
+        uint16_t next = instruction.address + opcodeLengths[opcode];
+        uint16_t absolute = instruction.operand[0] | (instruction.operand[1] << 8);
+        string cycles = "    n.masterClock += " + to_string(opcodeCycles[opcode] * 3) + ";\n";
+
+        out << "    //" << HexDigits(instruction.address, 4) << ": " << HexDigits(opcode, 2) << "\n";
+        if((opcode & 0x1F) == 0x10)
+        {
+            out << "    n.registers.programCounter = " << Hex(next, 4) << ";\n";
+            out << "    n.branch6502(NES::" << branchFlags[opcode >> 5] << ", " << ((opcode & 0x20) ? "true" : "false")
+                << ", (int8_t)" << Hex(instruction.operand[0], 2) << ");\n" << cycles << "    return;\n";
+        }
+        else if(opcode == 0x4C)
+        {
+            out << "    n.registers.programCounter = " << Hex(absolute, 4) << ";\n";
+            if(absolute <= instruction.address)
+                out << "    n.CheckIdleLoop(" << Hex(instruction.address, 4) << ");\n";
+            out << cycles << "    return;\n";
+        }
+        else if(opcode == 0x20)
+        {
+            out << "    n.PushStack16Bit(" << Hex((uint16_t)(instruction.address + 2), 4) << ");\n";
+            out << "    n.registers.programCounter = " << Hex(absolute, 4) << ";\n" << cycles << "    return;\n";
+        }
+        else if(!templateTable[opcode] || IsControlFlowOpcode(opcode))
+        {
+            //returns, interrupts, indirect jumps and anything unusual go through the interpreter
+            out << "    n.registers.programCounter = " << Hex(instruction.address, 4) << ";\n";
+            out << "    n.ExecuteInstruction();\n    return;\n";
+        }
+        else
+        {
+            out << "    n.registers.programCounter = " << Hex(next, 4) << ";\n";
+            string statement = OperandStatement(*templateTable[opcode], instruction);
+            if(!statement.empty())
+                out << "    " << statement << ";\n";
+            out << cycles;
+            if(i + 1 < block.size())
+                out << "    if(AOTCore::Stop(n))\n        return;\n";
+        }
+    }
+    out << "}\n\n";
+}
+
+void Emit(const string& path, const string& romName)
+{
+    uint32_t hash = HashPRG();
+    string program = "AOTProgram<" + Hex(hash, 8) + ">";
+
+    filesystem::path outputPath = path;
+    if(outputPath.has_parent_path())
+        filesystem::create_directories(outputPath.parent_path());
+    ofstream out(outputPath);
+    if(!out.is_open())
+    {
+        cerr << "Unable to write " << path << '\n';
+        exit(2);
+    }
+
+    out << "//generated by tools/nesrecomp from " << romName << ", do not edit\n";
+    out << "#include \"../aot.h\"\n\n";
+    out << "template<> struct " << program << "\n{\n";
+    for(auto& [start, block] : blocks)
+        out << "    static void Block" << HexDigits(start, 4) << "(NES& n);\n";
+    out << "};\n\n";
+
+    for(auto& [start, block] : blocks)
+        EmitBlock(out, program, start, block);
+
+    out << "static const AOTBlockTable table = []\n{\n    AOTBlockTable table{};\n";
+    for(auto& [start, block] : blocks)
+        out << "    table[" << Hex(start - 0x8000, 4) << "] = &" << program << "::Block" << HexDigits(start, 4) << ";\n";
+    out << "    return table;\n}();\n\n";
+    out << "static AOTCore::Registration registration(" << Hex(hash, 8) << ", table);\n";
+
+    cout << "Wrote " << blocks.size() << " blocks for PRG " << Hex(hash, 8) << " to " << path << '\n';
+}
+
+int main(int argc, char* argv[])
+{
+    if(argc < 2)
+    {
+        cerr << "usage: nesrecomp game.nes [output.cpp]\n";
+        return 1;
+    }
+
+    for(const OpcodeTemplate& opcodeTemplate : templates)
+        templateTable[opcodeTemplate.opcode] = &opcodeTemplate;
+
+    filesystem::path romPath = argv[1];
+    LoadROM(romPath.string());
+    TraceBlocks();
+    Emit(argc > 2 ? argv[2] : "src/aot/" + romPath.stem().string() + ".cpp", romPath.filename().string());
+}